@@ -10,8 +10,15 @@
 #include "async_task.h"
 #include "usb_boot_device.h"
 #include "usb_msc.h"
+#include "virtual_disk.h"
 #include "boot/picoboot.h"
 #include "hardware/sync.h"
+#ifdef USE_FLASH_VERIFY
+#include "bootrom_crc32.h"
+#endif
+#ifdef USE_BATCHED_TASK_COMPLETION
+#include "hardware/regs/intctrl.h"
+#endif
 
 //#define NO_ASYNC
 //#define NO_ROM_READ
@@ -24,6 +31,9 @@ static uint32_t _do_flash_erase_sector(uint32_t addr);
 static uint32_t _do_flash_erase_range(uint32_t addr, uint32_t len);
 static uint32_t _do_flash_page_program(uint32_t addr, uint8_t *data);
 static uint32_t _do_flash_page_read(uint32_t addr, uint8_t *data);
+#ifdef USE_FLASH_BLOCK_ERASE
+static uint32_t _do_flash_erase_block(uint32_t addr, uint32_t size, uint8_t cmd);
+#endif
 static bool _is_address_safe_for_vectoring(uint32_t addr);
 
 // keep table of flash function pointers in case RPI user wants to redirect them
@@ -35,6 +45,10 @@ static const struct flash_funcs {
     uint32_t (*do_flash_erase_range)(uint32_t addr, uint32_t size);
     uint32_t (*do_flash_page_program)(uint32_t addr, uint8_t *data);
     uint32_t (*do_flash_page_read)(uint32_t addr, uint8_t *data);
+#ifdef USE_FLASH_BLOCK_ERASE
+    // (added at the end, so the table is laid out as before up to here)
+    uint32_t (*do_flash_erase_block)(uint32_t addr, uint32_t size, uint8_t cmd);
+#endif
 } default_flash_funcs = {
         .size = sizeof(struct flash_funcs),
         _do_flash_enter_cmd_xip,
@@ -43,13 +57,115 @@ static const struct flash_funcs {
         _do_flash_erase_range,
         _do_flash_page_program,
         _do_flash_page_read,
+#ifdef USE_FLASH_BLOCK_ERASE
+        _do_flash_erase_block,
+#endif
 };
 
 const struct flash_funcs *flash_funcs;
 
+#ifdef USE_FLASH_ERASE_SUSPEND
+#define FLASHCMD_SECTOR_ERASE 0x20
+static void _flash_erase_suspendable(uint32_t addr, uint32_t size, uint8_t cmd);
+void execute_task(struct async_task_queue *queue, struct async_task *task);
+#endif
+
+#ifdef USE_FLASH_BLOCK_ERASE
+// standard 32K and 64K block erase commands
+#define FLASHCMD_BLOCK_ERASE_32K 0x52
+#define FLASHCMD_BLOCK_ERASE_64K 0xd8
+#endif
+
+#ifdef USE_FLASH_GEOMETRY
+struct flash_geometry async_task_flash_geometry;
+#endif
+
+#ifdef USE_CURRENT_UF2
+uint8_t async_task_flash_size_log2;
+// true while the flash is in serial command mode, i.e. after an exit XIP and before any enter cmd XIP
+static bool _flash_serial;
+#endif
+
+#ifdef USE_FLASH_BAUD_CALIBRATION
+// SSI clock divider for the session, chosen on the first exit XIP; 0 until then
+static uint8_t _flash_baud_div;
+
+#define FLASH_BAUD_CAL_BYTES 32u
+
+// read the start of the flash with the command page reads (and command mode XIP) use, or the start of SFDP
+static void _flash_baud_cal_read(bool sfdp, uint32_t *buf) {
+    if (sfdp) {
+        flash_read_sfdp(0, (uint8_t *) buf, FLASH_BAUD_CAL_BYTES);
+        return;
+    }
+#ifdef USE_FLASH_FAST_READ
+    flash_read_data_fast(0, (uint8_t *) buf, FLASH_BAUD_CAL_BYTES);
+#else
+    flash_read_data(0, (uint8_t *) buf, FLASH_BAUD_CAL_BYTES);
+#endif
+}
+
+// returns the divider chosen, which is left set
+static uint _calibrate_flash_baud_div() {
+    uint32_t ref[FLASH_BAUD_CAL_BYTES / 4];
+    uint32_t buf[FLASH_BAUD_CAL_BYTES / 4];
+    uint div = FLASH_BAUD_DIV_DEFAULT;
+    // calibrate with the reads the divider is for, of whatever is at the start of the flash (as read at the default
+    // rate, which boot2 and XIP have been using). Data which is all the same byte (e.g. erased flash) may still read
+    // back the same when sampled late, so then use the SFDP header instead, which reads the same on every part which
+    // has SFDP; but only for fast reads, whose dummy byte 5Ah SFDP reads share (03h reads are often only specified up
+    // to a lower clock). Without either we have nothing to go on, so stay at the default
+    bool sfdp = false;
+    _flash_baud_cal_read(sfdp, ref);
+    const uint8_t *ref_bytes = (const uint8_t *) ref;
+    bool usable = false;
+    for (uint i = 1; i < FLASH_BAUD_CAL_BYTES; i++) {
+        usable |= ref_bytes[i] != ref_bytes[0];
+    }
+#ifdef USE_FLASH_FAST_READ
+    if (!usable) {
+        sfdp = true;
+        _flash_baud_cal_read(sfdp, ref);
+        usable = ref[0] == ('S' | ('F' << 8) | ('D' << 16) | ('P' << 24));
+    }
+#endif
+    if (usable) {
+        while (div > FLASH_BAUD_DIV_MIN) {
+            flash_set_baud_div(div - 2);
+            uint bad = 0;
+            for (uint n = 0; n < FLASH_BAUD_CAL_READS && !bad; n++) {
+                _flash_baud_cal_read(sfdp, buf);
+                for (uint i = 0; i < count_of(buf); i++) {
+                    bad |= buf[i] ^ ref[i];
+                }
+            }
+            if (bad) break;
+            div -= 2;
+        }
+        div = MIN(div + FLASH_BAUD_CAL_MARGIN, FLASH_BAUD_DIV_DEFAULT);
+#ifdef USE_FLASH_QUAD
+        // flash_page_program_quad can't keep the TX FIFO fed at clk_sys/2
+        div = MAX(div, 4);
+#endif
+    }
+    usb_warn("flash baud div %d\n", div);
+    flash_set_baud_div(div);
+    return div;
+}
+#endif
+
+#ifdef USE_FLASH_QUAD
+// true if the flash geometry allows quad commands, and QE is set
+static bool _flash_quad;
+#endif
+
 static uint32_t _do_flash_enter_cmd_xip() {
     usb_warn("flash ennter cmd XIP\n");
+#ifdef USE_FLASH_FAST_READ
+    flash_enter_cmd_xip_fast();
+#else
     flash_enter_cmd_xip();
+#endif
     return 0;
 }
 
@@ -59,6 +175,26 @@ static uint32_t _do_flash_exit_xip() {
     connect_internal_flash();
     DEBUG_PINS_SET(flash, 4);
     flash_exit_xip();
+#ifdef USE_FLASH_BAUD_CALIBRATION
+    if (_flash_baud_div) {
+        flash_set_baud_div(_flash_baud_div);
+    } else {
+        _flash_baud_div = (uint8_t) _calibrate_flash_baud_div();
+    }
+#endif
+#ifdef USE_FLASH_GEOMETRY
+    struct flash_geometry *geometry = &async_task_flash_geometry;
+    if (!flash_read_geometry(geometry)) {
+        // no SFDP; assume the standard block erases, as USE_FLASH_BLOCK_ERASE does without a geometry
+        geometry->erase_types[1].size_log2 = 15;
+        geometry->erase_types[1].cmd = FLASHCMD_BLOCK_ERASE_32K;
+        geometry->erase_types[2].size_log2 = 16;
+        geometry->erase_types[2].cmd = FLASHCMD_BLOCK_ERASE_64K;
+    }
+#ifdef USE_FLASH_QUAD
+    _flash_quad = geometry->quad_out_read_cmd && geometry->qer != FLASH_QER_UNKNOWN && flash_enable_quad(geometry->qer);
+#endif
+#endif
     DEBUG_PINS_CLR(flash, 6);
 #ifdef USE_BOOTROM_GPIO
     gpio_setup();
@@ -69,34 +205,226 @@ static uint32_t _do_flash_exit_xip() {
 static uint32_t _do_flash_erase_sector(uint32_t addr) {
     usb_warn("erasing flash sector @%08x\n", (uint) addr);
     DEBUG_PINS_SET(flash, 2);
+#ifdef USE_FLASH_ERASE_SUSPEND
+    _flash_erase_suspendable(addr, FLASH_SECTOR_ERASE_SIZE, FLASHCMD_SECTOR_ERASE);
+#else
     flash_sector_erase(addr - XIP_MAIN_BASE);
+#endif
+    DEBUG_PINS_CLR(flash, 2);
+    return 0;
+}
+
+#ifdef USE_PICOBOOT_RESUME
+struct async_task_progress async_task_progress;
+// token (our internal one) of the command async_task_progress is for
+static uint32_t _progress_task_token;
+// true while executing a PICOBOOT task
+static bool _progress_tracking;
+
+static void _commit_progress(uint32_t *end, uint32_t addr) {
+    // note the abort state persists until the next exit XIP, so we can't count anything the worker does after it
+    if (_progress_tracking && !flash_was_aborted()) {
+        *end = addr;
+    }
+}
+#define COMMIT_PROGRESS(field, addr) _commit_progress(&async_task_progress.field, addr)
+#else
+#define COMMIT_PROGRESS(field, addr) ((void)0)
+#endif
+
+#ifdef USE_FLASH_ERASE_SUSPEND
+#ifdef USE_PICOBOOT
+// PICOBOOT read run while an erase is suspended
+static struct async_task _erase_suspended_task;
+#ifdef USE_TASK_STATS
+// time the last suspendable erase spent running reads, which isn't counted against whatever task type did the erase
+static uint32_t _erase_suspended_us;
+#endif
+
+// if the next PICOBOOT task is a read of flash outside [addr, addr + size), dequeue it into _erase_suspended_task
+static bool _dequeue_read_outside(uint32_t addr, uint32_t size) {
+    bool have_task = false;
+    // (dequeue_task times its own IRQs disabled window)
+    uint32_t save = save_and_disable_interrupts();
+    if (async_task_queue_count(&picoboot_queue)) {
+        const struct async_task *task = &picoboot_queue.tasks[picoboot_queue.tail & (ASYNC_TASK_QUEUE_DEPTH - 1u)];
+        if (task->type == AT_READ && is_address_flash(task->transfer_addr) &&
+            (task->transfer_addr + task->data_length <= addr || task->transfer_addr >= addr + size)) {
+            have_task = dequeue_task(&picoboot_queue, &_erase_suspended_task);
+        }
+    }
+    restore_interrupts(save);
+    return have_task;
+}
+#endif
+
+// Erase size bytes at addr with cmd, polling for completion here rather than in flash_wait_ready. If the flash supports
+// erase suspend, PICOBOOT reads of other parts of the flash which arrive meanwhile are run with the erase suspended,
+// rather than waiting for it to finish. The erase gets to run for at least FLASH_ERASE_SUSPEND_MIN_RUN_US between
+// suspends, so a stream of reads can't stop it completing.
+static void _flash_erase_suspendable(uint32_t addr, uint32_t size, uint8_t cmd) {
+    flash_user_erase_start(addr - XIP_MAIN_BASE, cmd);
+#ifdef USE_PICOBOOT
+    const struct flash_geometry *geometry = &async_task_flash_geometry;
+    uint32_t resumed = time_us_32();
+#ifdef USE_TASK_STATS
+    // (only handed over once done, so the reads' own stats don't deduct it)
+    uint32_t suspended_us = 0;
+#endif
+#endif
+    while (flash_busy() && !flash_was_aborted()) {
+#ifdef USE_PICOBOOT
+        if (geometry->erase_suspend_cmd && time_us_32() - resumed >= FLASH_ERASE_SUSPEND_MIN_RUN_US &&
+            _dequeue_read_outside(addr, size)) {
+            usb_warn("suspending erase @%08x for read @%08x\n", (uint) addr, (uint) _erase_suspended_task.transfer_addr);
+#ifdef USE_TASK_STATS
+            uint32_t suspended = time_us_32();
+#endif
+            flash_do_cmd(geometry->erase_suspend_cmd, NULL, NULL, 0);
+            // the flash reports not busy once suspended
+            while (flash_busy() && !flash_was_aborted());
+#ifdef USE_PICOBOOT_RESUME
+            // the read mustn't take over the erase's progress reporting
+            bool progress_tracking = _progress_tracking;
+#endif
+            execute_task(&picoboot_queue, &_erase_suspended_task);
+#ifdef USE_PICOBOOT_RESUME
+            _progress_tracking = progress_tracking;
+#endif
+            flash_do_cmd(geometry->erase_resume_cmd, NULL, NULL, 0);
+            resumed = time_us_32();
+#ifdef USE_TASK_STATS
+            suspended_us += resumed - suspended;
+#endif
+        }
+#endif
+    }
+#if defined(USE_PICOBOOT) && defined(USE_TASK_STATS)
+    _erase_suspended_us += suspended_us;
+#endif
+}
+#endif
+
+#ifdef USE_FLASH_BLOCK_ERASE
+// return the size of the largest block erase (bigger than a sector) that can be used at addr without going past end,
+// with its command in *cmd, or 0 if there is none
+static uint32_t _choose_block_erase(uint32_t addr, uint32_t end, uint8_t *cmd) {
+#ifdef USE_FLASH_GEOMETRY
+    const struct flash_erase_type *et = async_task_flash_geometry.erase_types + FLASH_ERASE_TYPES;
+    while (et-- > async_task_flash_geometry.erase_types) {
+        if (et->size_log2 > FLASH_SECTOR_ERASE_SIZE_LOG2 && et->size_log2 < 32) {
+            uint32_t block_size = 1u << et->size_log2;
+            if (!(addr & (block_size - 1)) && end - addr >= block_size) {
+                *cmd = et->cmd;
+                return block_size;
+            }
+        }
+    }
+#else
+    for (uint32_t block_size = FLASH_BLOCK_ERASE_SIZE_64K; block_size >= FLASH_BLOCK_ERASE_SIZE_32K; block_size >>= 1u) {
+        if (!(addr & (block_size - 1)) && end - addr >= block_size) {
+            *cmd = block_size == FLASH_BLOCK_ERASE_SIZE_64K ? FLASHCMD_BLOCK_ERASE_64K : FLASHCMD_BLOCK_ERASE_32K;
+            return block_size;
+        }
+    }
+#endif
+    return 0;
+}
+
+static uint32_t _do_flash_erase_block(uint32_t addr, uint32_t size, uint8_t cmd) {
+    usb_warn("erasing flash block @%08x+%08x\n", (uint) addr, (uint) size);
+    DEBUG_PINS_SET(flash, 2);
+#ifdef USE_FLASH_ERASE_SUSPEND
+    _flash_erase_suspendable(addr, size, cmd);
+#else
+    flash_user_erase(addr - XIP_MAIN_BASE, cmd);
+#endif
     DEBUG_PINS_CLR(flash, 2);
     return 0;
 }
+#endif
 
 static uint32_t _do_flash_erase_range(uint32_t addr, uint32_t len) {
     uint32_t end = addr + len;
     uint32_t ret = PICOBOOT_OK;
     while (addr < end && !ret) {
+#ifdef USE_FLASH_BLOCK_ERASE
+        // use a block erase for any aligned block entirely within the range, since these are much faster per byte
+        uint8_t block_cmd;
+        uint32_t block_size = _choose_block_erase(addr, end, &block_cmd);
+        if (block_size) {
+            ret = flash_funcs->do_flash_erase_block(addr, block_size, block_cmd);
+            addr += block_size;
+            if (!ret) COMMIT_PROGRESS(erase_end, addr);
+            continue;
+        }
+#endif
         ret = flash_funcs->do_flash_erase_sector(addr);
         addr += FLASH_SECTOR_ERASE_SIZE;
+        if (!ret) COMMIT_PROGRESS(erase_end, addr);
     }
     return ret;
 }
 
+#ifdef USE_FLASH_VERIFY
+struct flash_verify_status flash_verify_status;
+
+#define _verify_page_buf ((uint8_t *) FLASH_VERIFY_BUFFER_BASE)
+
+// read back a page we have just programmed, and check it has the data we programmed
+static uint32_t _verify_flash_page(uint32_t addr, const uint8_t *data) {
+    uint32_t ret = flash_funcs->do_flash_page_read(addr, _verify_page_buf);
+    // (an aborted read tells us nothing, and the task's result is ignored anyway)
+    if (ret || flash_was_aborted()) return ret;
+    for (uint i = 0; i < FLASH_PAGE_SIZE; i++) {
+        if (_verify_page_buf[i] != data[i]) {
+            usb_warn("flash page @%08x failed verify at +%02x\n", (uint) addr, i);
+            if (!flash_verify_status.mismatches++) flash_verify_status.first_mismatch_addr = addr;
+            return PICOBOOT_UNKNOWN_ERROR;
+        }
+    }
+    return PICOBOOT_OK;
+}
+#endif
+
 static uint32_t _do_flash_page_program(uint32_t addr, uint8_t *data) {
     usb_warn("writing flash page @%08x\n", (uint) addr);
     DEBUG_PINS_SET(flash, 4);
+#ifdef USE_FLASH_QUAD
+    if (_flash_quad) {
+        flash_page_program_quad(addr - XIP_MAIN_BASE, data);
+    } else
+#endif
+#ifdef USE_FLASH_DMA
+    flash_page_program_dma(addr - XIP_MAIN_BASE, data);
+#else
     flash_page_program(addr - XIP_MAIN_BASE, data);
+#endif
     DEBUG_PINS_CLR(flash, 4);
+#ifdef USE_FLASH_VERIFY
+    return _verify_flash_page(addr, data);
+#else
     // todo set error result
     return 0;
+#endif
 }
 
 static uint32_t _do_flash_page_read(uint32_t addr, uint8_t *data) {
     DEBUG_PINS_SET(flash, 4);
     usb_warn("reading flash page @%08x\n", (uint) addr);
+#ifdef USE_FLASH_QUAD
+    if (_flash_quad) {
+        flash_read_data_quad(addr - XIP_MAIN_BASE, data, FLASH_PAGE_SIZE, async_task_flash_geometry.quad_out_read_cmd,
+                             async_task_flash_geometry.quad_out_read_dummy_clocks);
+    } else
+#endif
+#if defined(USE_FLASH_FAST_READ)
+    flash_read_data_fast(addr - XIP_MAIN_BASE, data, FLASH_PAGE_SIZE);
+#elif defined(USE_FLASH_DMA)
+    flash_read_data_dma(addr - XIP_MAIN_BASE, data, FLASH_PAGE_SIZE);
+#else
     flash_read_data(addr - XIP_MAIN_BASE, data, FLASH_PAGE_SIZE);
+#endif
     DEBUG_PINS_CLR(flash, 4);
     // todo set error result
     return 0;
@@ -105,11 +433,256 @@ static uint32_t _do_flash_page_read(uint32_t addr, uint8_t *data) {
 static bool _is_address_safe_for_vectoring(uint32_t addr) {
     // not we are inclusive at end to save arithmentic, and since we always checking for non empty ranges
     return is_address_ram(addr) &&
-           (addr < FLASH_VALID_BLOCKS_BASE || addr > FLASH_VALID_BLOCKS_BASE + FLASH_BITMAPS_SIZE);
+           (addr < FLASH_VALID_BLOCKS_BASE ||
+            addr > FLASH_VALID_BLOCKS_BASE + FLASH_BITMAPS_SIZE + DIFF_FLASH_BUFFER_SIZE + FLASH_VERIFY_BUFFER_SIZE +
+                   UF2_ASSEMBLY_BUFFER_SIZE + VD_SECTOR_CACHE_BUFFER_SIZE);
+}
+
+#ifdef USE_DIFFERENTIAL_FLASH
+// Before writing, read back what is already in flash, and skip any work that isn't needed to get the same result.
+//
+// UF2 page writes which would erase their sector first instead defer the erase; subsequent pages in that sector
+// which match are skipped, and those which only clear bits are programmed directly. If a page needs bits set,
+// we erase after all, restoring the pages of the sector we have already handled. Only one erase is deferred at a
+// time, so the same happens when the UF2 moves on to another sector with pages of this one not yet handled (they may
+// still turn up out of order). Note therefore that pages in a sector which are not part of the UF2 image may keep
+// their old contents rather than being erased, if the rest of the sector needed no erase.
+struct diff_flash_stats diff_flash_stats;
+
+#define _diff_sector_buf ((uint8_t *) DIFF_FLASH_BUFFER_BASE)
+#define _diff_page_buf ((uint8_t *) (DIFF_FLASH_BUFFER_BASE + FLASH_SECTOR_ERASE_SIZE))
+
+// sector whose erase has been deferred (0 for none), and a mask of the pages within it we have written (or skipped)
+static uint32_t _deferred_erase_addr;
+static uint16_t _deferred_erase_handled_pages;
+
+static uint32_t _do_diff_flash_erase_range(uint32_t addr, uint32_t len) {
+    if (_deferred_erase_addr - addr < len) {
+        // being erased anyway
+        _deferred_erase_addr = 0;
+    }
+    for (uint32_t offset = 0; offset < len; offset += FLASH_PAGE_SIZE) {
+        uint32_t ret = flash_funcs->do_flash_page_read(addr + offset, _diff_page_buf);
+        if (ret) return ret;
+        for (uint i = 0; i < FLASH_PAGE_SIZE / 4; i++) {
+            if (((uint32_t *) _diff_page_buf)[i] != 0xffffffffu) {
+                return flash_funcs->do_flash_erase_range(addr, len);
+            }
+        }
+    }
+    usb_warn("skipping erase of blank flash @%08x+%08x\n", (uint) addr, (uint) len);
+    diff_flash_stats.erases_skipped += len / FLASH_SECTOR_ERASE_SIZE;
+    return PICOBOOT_OK;
+}
+
+// erase the sector whose erase was deferred after all, restoring the pages of it we have already handled
+static uint32_t _do_deferred_erase() {
+    uint32_t sector_addr = _deferred_erase_addr;
+    usb_warn("doing deferred erase of flash sector @%08x\n", (uint) sector_addr);
+    uint32_t ret;
+    uint32_t offset;
+    for (offset = 0; offset < FLASH_SECTOR_ERASE_SIZE; offset += FLASH_PAGE_SIZE) {
+        if (_deferred_erase_handled_pages & (1u << (offset / FLASH_PAGE_SIZE))) {
+            ret = flash_funcs->do_flash_page_read(sector_addr + offset, _diff_sector_buf + offset);
+            if (ret) return ret;
+        }
+    }
+    ret = flash_funcs->do_flash_erase_sector(sector_addr);
+    if (ret) return ret;
+    for (offset = 0; offset < FLASH_SECTOR_ERASE_SIZE; offset += FLASH_PAGE_SIZE) {
+        if (_deferred_erase_handled_pages & (1u << (offset / FLASH_PAGE_SIZE))) {
+            ret = flash_funcs->do_flash_page_program(sector_addr + offset, _diff_sector_buf + offset);
+            if (ret) return ret;
+        }
+    }
+    diff_flash_stats.erases_skipped--;
+    // (the rest of the sector is erased now, so can be programmed directly)
+    _deferred_erase_addr = 0;
+    return PICOBOOT_OK;
 }
 
+static uint32_t _do_diff_flash_page_program(uint32_t addr, uint8_t *data) {
+    uint32_t ret = flash_funcs->do_flash_page_read(addr, _diff_page_buf);
+    if (ret) return ret;
+    bool same = true;
+    bool clears_only = true;
+    for (uint i = 0; i < FLASH_PAGE_SIZE; i++) {
+        same &= data[i] == _diff_page_buf[i];
+        clears_only &= !(data[i] & ~_diff_page_buf[i]);
+    }
+    uint32_t sector_addr = addr & ~(FLASH_SECTOR_ERASE_SIZE - 1u);
+    uint32_t page_mask = 1u << ((addr - sector_addr) / FLASH_PAGE_SIZE);
+    if (sector_addr == _deferred_erase_addr) {
+        if (!same && !clears_only) {
+            ret = _do_deferred_erase();
+            if (ret) return ret;
+        } else {
+            _deferred_erase_handled_pages |= page_mask;
+        }
+    }
+    if (same) {
+        diff_flash_stats.programs_skipped++;
+        return PICOBOOT_OK;
+    }
+    return flash_funcs->do_flash_page_program(addr, data);
+}
+#endif
+
+#ifdef USE_UF2_PAGE_ASSEMBLY
+// UF2 writes needn't be whole flash pages. The parts of a write which cover a whole page are programmed straight from
+// the task's data; the rest goes into one of UF2_ASSEMBLY_PAGES page buffers, whose page is programmed once the buffer
+// has been filled, or when a task asks for the buffers to be flushed at the end of the image (with the bytes the image
+// didn't cover left erased).
+//
+// If a page is started with no buffer free, the partial page with the lowest address is programmed to make room. The
+// rest of that page may still turn up, so from then on buffers are started with what we have programmed in flash
+// rather than blank, and a page programmed a second time has the bytes already programmed unchanged
+#define _uf2_page_buf(i) ((uint8_t *) (UF2_ASSEMBLY_BUFFER_BASE + (i) * FLASH_PAGE_SIZE))
+
+static struct {
+    uint32_t addr; // 0 if the buffer is free
+    uint32_t fill; // bytes written so far
+} _uf2_pages[UF2_ASSEMBLY_PAGES];
+static bool _uf2_pages_from_flash;
+
+static void _reset_uf2_pages() {
+    for (uint i = 0; i < UF2_ASSEMBLY_PAGES; i++) {
+        _uf2_pages[i].addr = 0;
+    }
+    _uf2_pages_from_flash = false;
+}
+
+static uint32_t _program_uf2_page(uint32_t addr, uint8_t *data) {
+#ifdef USE_DIFFERENTIAL_FLASH
+    return _do_diff_flash_page_program(addr, data);
+#else
+    return flash_funcs->do_flash_page_program(addr, data);
+#endif
+}
+
+// program the page in buffer i, freeing the buffer
+static uint32_t _flush_uf2_page(uint i) {
+    uint32_t addr = _uf2_pages[i].addr;
+    _uf2_pages[i].addr = 0;
+    return _program_uf2_page(addr, _uf2_page_buf(i));
+}
+
+// program the partial pages in the sector at sector_addr, or all of them if sector_addr is 0
+static uint32_t _flush_uf2_pages(uint32_t sector_addr) {
+    for (uint i = 0; i < UF2_ASSEMBLY_PAGES; i++) {
+        uint32_t addr = _uf2_pages[i].addr;
+        if (addr && (!sector_addr || (addr & ~(FLASH_SECTOR_ERASE_SIZE - 1u)) == sector_addr)) {
+            uint32_t ret = _flush_uf2_page(i);
+            if (ret) return ret;
+        }
+    }
+    return PICOBOOT_OK;
+}
+
+// copy len bytes into the page at page_addr, starting at offset
+static uint32_t _assemble_uf2_page(uint32_t page_addr, uint offset, const uint8_t *data, uint len) {
+    uint32_t ret;
+    uint i;
+    for (i = 0; i < UF2_ASSEMBLY_PAGES && _uf2_pages[i].addr != page_addr; i++);
+    if (i == UF2_ASSEMBLY_PAGES) {
+        // a free buffer (address 0) sorts lowest
+        i = 0;
+        for (uint j = 1; j < UF2_ASSEMBLY_PAGES; j++) {
+            if (_uf2_pages[j].addr < _uf2_pages[i].addr) i = j;
+        }
+        if (_uf2_pages[i].addr) {
+            usb_warn("programming partial flash page @%08x to make room\n", (uint) _uf2_pages[i].addr);
+            ret = _flush_uf2_page(i);
+            if (ret) return ret;
+            _uf2_pages_from_flash = true;
+        }
+        bool blank = !_uf2_pages_from_flash;
+#ifdef USE_DIFFERENTIAL_FLASH
+        // (a page in the sector whose erase is deferred has the old contents until it has been handled)
+        blank |= (page_addr & ~(FLASH_SECTOR_ERASE_SIZE - 1u)) == _deferred_erase_addr &&
+                 !(_deferred_erase_handled_pages & (1u << ((page_addr / FLASH_PAGE_SIZE) & 15u)));
+#endif
+        if (!blank) {
+            ret = flash_funcs->do_flash_page_read(page_addr, _uf2_page_buf(i));
+            if (ret) return ret;
+        } else {
+            for (uint j = 0; j < FLASH_PAGE_SIZE / 4; j++) {
+                ((uint32_t *) _uf2_page_buf(i))[j] = 0xffffffffu;
+            }
+        }
+        _uf2_pages[i].addr = page_addr;
+        _uf2_pages[i].fill = 0;
+    }
+    memcpy(_uf2_page_buf(i) + offset, data, len);
+    _uf2_pages[i].fill += len;
+    return _uf2_pages[i].fill >= FLASH_PAGE_SIZE ? _flush_uf2_page(i) : PICOBOOT_OK;
+}
+
+static uint32_t _do_uf2_page_assembly_write(uint32_t addr, uint8_t *data, uint32_t len) {
+    while (len) {
+        uint32_t page_addr = addr & ~FLASH_PAGE_MASK;
+        uint offset = addr - page_addr;
+        uint n = MIN(len, FLASH_PAGE_SIZE - offset);
+        uint32_t ret = n == FLASH_PAGE_SIZE ? _program_uf2_page(addr, data) :
+                       _assemble_uf2_page(page_addr, offset, data, n);
+        if (ret) return ret;
+        addr += n;
+        data += n;
+        len -= n;
+    }
+    return PICOBOOT_OK;
+}
+#endif
+
 static uint8_t _last_mutation_source;
 
+#ifdef USE_TASK_STATS
+struct async_task_stats async_task_stats[ASYNC_TASK_STATS_COUNT];
+
+// record the time since start against the given stats entry, returning the current time
+static uint32_t _record_task_stats(uint index, uint32_t start) {
+    uint32_t now = time_us_32();
+    uint32_t elapsed = now - start;
+    struct async_task_stats *stats = &async_task_stats[index];
+    if (!stats->count || elapsed < stats->min_us) stats->min_us = elapsed;
+    if (elapsed > stats->max_us) stats->max_us = elapsed;
+    stats->total_us += elapsed;
+    stats->count++;
+    return now;
+}
+
+// each task type is timed from the end of the previous one
+#define TASK_STATS_START() uint32_t _stats_time = time_us_32()
+#if defined(USE_FLASH_ERASE_SUSPEND) && defined(USE_PICOBOOT)
+// less the time an erase for it spent suspended running reads
+#define TASK_STATS_RECORD(type) do { \
+    _stats_time = _record_task_stats(__builtin_ctz(type), _stats_time + _erase_suspended_us); \
+    _erase_suspended_us = 0; \
+} while (0)
+#else
+#define TASK_STATS_RECORD(type) _stats_time = _record_task_stats(__builtin_ctz(type), _stats_time)
+#endif
+
+// IRQs are only disabled by the worker (in thread mode), so there is only ever one such window to time
+static uint32_t _irqs_disabled_time;
+
+static uint32_t _worker_disable_interrupts() {
+    uint32_t save = save_and_disable_interrupts();
+    _irqs_disabled_time = time_us_32();
+    return save;
+}
+
+static void _worker_restore_interrupts(uint32_t save) {
+    _record_task_stats(ASYNC_TASK_STATS_IRQS_DISABLED, _irqs_disabled_time);
+    restore_interrupts(save);
+}
+#else
+#define TASK_STATS_START() ((void)0)
+#define TASK_STATS_RECORD(type) ((void)0)
+#define _worker_disable_interrupts save_and_disable_interrupts
+#define _worker_restore_interrupts restore_interrupts
+#endif
+
 // NOTE for simplicity this returns error codes from PICOBOOT
 static uint32_t _execute_task(struct async_task *task) {
     uint32_t ret;
@@ -117,6 +690,20 @@ static uint32_t _execute_task(struct async_task *task) {
         return PICOBOOT_REBOOTING;
     }
     uint type = task->type;
+#ifdef USE_UF2_PAGE_ASSEMBLY
+    // how much of a UF2 write has been done ahead of its erase
+    uint32_t uf2_offset = 0;
+#endif
+#ifdef USE_PICOBOOT_RESUME
+    _progress_tracking = task->source == TASK_SOURCE_PICOBOOT;
+    if (_progress_tracking && task->token != _progress_task_token) {
+        // first task for a new command
+        _progress_task_token = task->token;
+        async_task_progress.token = task->picoboot_user_token;
+        async_task_progress.erase_end = task->erase_addr;
+        async_task_progress.program_end = task->transfer_addr;
+    }
+#endif
     if (type & AT_VECTORIZE_FLASH) {
         if (task->transfer_addr & 1u) {
             return PICOBOOT_BAD_ALIGNMENT;
@@ -137,20 +724,40 @@ static uint32_t _execute_task(struct async_task *task) {
             msc_eject();
         }
     }
+    TASK_STATS_START();
     if (type & AT_EXIT_XIP) {
+#ifdef USE_FLASH_VERIFY
+        memset0(&flash_verify_status, sizeof(flash_verify_status));
+        flash_verify_status.crc = 0xffffffffu;
+#endif
         ret = flash_funcs->do_flash_exit_xip();
+        TASK_STATS_RECORD(AT_EXIT_XIP);
         if (ret) return ret;
+#ifdef USE_CURRENT_UF2
+        _flash_serial = true;
+#endif
+#ifdef USE_UF2_PAGE_ASSEMBLY
+        // a new UF2 download; anything left over from the last one is stale
+        if (task->source == TASK_SOURCE_VIRTUAL_DISK) _reset_uf2_pages();
+#endif
     }
     if (type & AT_EXEC) {
         usb_warn("exec %08x\n", (uint) task->transfer_addr);
         // scary but true; note callee must not overflow our stack (note also we reuse existing field task->transfer_addr to save code/data space)
         (((void (*)()) (task->transfer_addr | 1u)))();
+        TASK_STATS_RECORD(AT_EXEC);
     }
     if (type & (AT_WRITE | AT_FLASH_ERASE)) {
         if (task->check_last_mutation_source && _last_mutation_source != task->source) {
             return PICOBOOT_INTERLEAVED_WRITE;
         }
         _last_mutation_source = task->source;
+#ifdef USE_DIFFERENTIAL_FLASH
+        if (task->source != TASK_SOURCE_VIRTUAL_DISK) {
+            // only UF2 writes defer erases
+            _deferred_erase_addr = 0;
+        }
+#endif
     }
     if (type & AT_FLASH_ERASE) {
         usb_warn("request flash erase at %08x+%08x\n", (uint) task->erase_addr, (uint) task->erase_size);
@@ -160,8 +767,46 @@ static uint32_t _execute_task(struct async_task *task) {
         if (!(is_address_flash(task->erase_addr) && is_address_flash(task->erase_addr + task->erase_size))) {
             return PICOBOOT_INVALID_ADDRESS;
         }
+#ifdef USE_UF2_PAGE_ASSEMBLY
+        if ((type & AT_WRITE) && task->source == TASK_SOURCE_VIRTUAL_DISK && task->transfer_addr < task->erase_addr) {
+            // the write starts in a sector which has already been erased (or had its erase deferred, which this erase
+            // would take over from), so program the pages there first
+            if (!is_address_flash(task->transfer_addr)) return PICOBOOT_INVALID_ADDRESS;
+            uf2_offset = MIN(task->erase_addr - task->transfer_addr, task->data_length);
+            ret = _do_uf2_page_assembly_write(task->transfer_addr, task->data, uf2_offset);
+            if (ret) return ret;
+        }
+#endif
+#ifdef USE_DIFFERENTIAL_FLASH
+        if ((type & AT_WRITE) && task->source == TASK_SOURCE_VIRTUAL_DISK &&
+            task->erase_size == FLASH_SECTOR_ERASE_SIZE) {
+            // note this task's write is validated below before we do anything with the sector
+            if (_deferred_erase_addr) {
+#ifdef USE_UF2_PAGE_ASSEMBLY
+                // partial pages in the sector whose erase was deferred must be programmed while it still is
+                ret = _flush_uf2_pages(_deferred_erase_addr);
+                if (ret) return ret;
+#endif
+                // any of its pages not handled yet may need bits set when they turn up, so erase it now
+                if (_deferred_erase_addr && _deferred_erase_handled_pages != 0xffffu) {
+                    ret = _do_deferred_erase();
+                    if (ret) return ret;
+                }
+            }
+            _deferred_erase_addr = task->erase_addr;
+            _deferred_erase_handled_pages = 0;
+            diff_flash_stats.erases_skipped++;
+            ret = PICOBOOT_OK;
+        } else {
+            ret = _do_diff_flash_erase_range(task->erase_addr, task->erase_size);
+        }
+#else
         ret = flash_funcs->do_flash_erase_range(task->erase_addr, task->erase_size);
+#endif
+        TASK_STATS_RECORD(AT_FLASH_ERASE);
         if (ret) return ret;
+        // in case the erase was skipped or vectored elsewhere
+        COMMIT_PROGRESS(erase_end, task->erase_addr + task->erase_size);
     }
     bool direct_access = false;
     if (type & (AT_WRITE | AT_READ)) {
@@ -175,7 +820,15 @@ static uint32_t _execute_task(struct async_task *task) {
         } else if ((is_address_flash(task->transfer_addr) &&
                     is_address_flash(task->transfer_addr + task->data_length))) {
             // flash
+#ifdef USE_UF2_PAGE_ASSEMBLY
+            // (UF2 writes are assembled into pages)
+            if ((task->transfer_addr & (FLASH_PAGE_SIZE - 1)) &&
+                !((type & AT_WRITE) && task->source == TASK_SOURCE_VIRTUAL_DISK)) {
+                return PICOBOOT_BAD_ALIGNMENT;
+            }
+#else
             if (task->transfer_addr & (FLASH_PAGE_SIZE - 1)) return PICOBOOT_BAD_ALIGNMENT;
+#endif
         } else {
             // bad address
             return PICOBOOT_INVALID_ADDRESS;
@@ -189,25 +842,68 @@ static uint32_t _execute_task(struct async_task *task) {
                     usb_warn("RAM write overlaps vectors, reverting them to ROM\n");
                     flash_funcs = &default_flash_funcs;
                 }
+#ifdef USE_VD_SECTOR_CACHE
+                if (MAX(VD_SECTOR_CACHE_BUFFER_BASE, task->transfer_addr) <
+                    MIN(VD_SECTOR_CACHE_BUFFER_BASE + VD_SECTOR_CACHE_BUFFER_SIZE,
+                        task->transfer_addr + task->data_length)) {
+                    usb_warn("RAM write overlaps the virtual disk's sector cache, disabling it\n");
+                    vd_sector_cache_disable();
+                }
+#endif
                 memcpy((void *) task->transfer_addr, task->data, task->data_length);
+                TASK_STATS_RECORD(AT_WRITE);
             } else {
+#ifdef USE_UF2_PAGE_ASSEMBLY
+                assert(task->data_length <= FLASH_PAGE_SIZE || task->source == TASK_SOURCE_VIRTUAL_DISK);
+                if (task->source == TASK_SOURCE_VIRTUAL_DISK) {
+                    ret = _do_uf2_page_assembly_write(task->transfer_addr + uf2_offset, task->data + uf2_offset,
+                                                      task->data_length - uf2_offset);
+                    if (!ret && task->flush_uf2_pages) ret = _flush_uf2_pages(0);
+                } else
+#else
                 assert(task->data_length <= FLASH_PAGE_SIZE);
+#endif
+#ifdef USE_DIFFERENTIAL_FLASH
+                ret = _do_diff_flash_page_program(task->transfer_addr, task->data);
+#else
                 ret = flash_funcs->do_flash_page_program(task->transfer_addr, task->data);
+#endif
+                TASK_STATS_RECORD(AT_WRITE);
                 if (ret) return ret;
+#ifdef USE_FLASH_VERIFY
+                // (this includes pages differential flashing found already had the data)
+                flash_verify_status.crc = bootrom_crc32(task->data, task->data_length, flash_verify_status.crc);
+                flash_verify_status.length += task->data_length;
+#endif
             }
+            COMMIT_PROGRESS(program_end, task->transfer_addr + task->data_length);
         }
         if (type & AT_READ) {
             if (direct_access) {
                 usb_warn("reading %08x +%04x\n", (uint) task->transfer_addr, (uint) task->data_length);
                 memcpy(task->data, (void *) task->transfer_addr, task->data_length);
+                TASK_STATS_RECORD(AT_READ);
             } else {
                 assert(task->data_length <= FLASH_PAGE_SIZE);
+#ifdef USE_CURRENT_UF2
+                // CURRENT.UF2 reads don't come with an exit XIP, and PICOBOOT may have entered cmd XIP since the last one
+                if (!_flash_serial && task->source == TASK_SOURCE_VIRTUAL_DISK) {
+                    ret = flash_funcs->do_flash_exit_xip();
+                    if (ret) return ret;
+                    _flash_serial = true;
+                }
+#endif
                 ret = flash_funcs->do_flash_page_read(task->transfer_addr, task->data);
+                TASK_STATS_RECORD(AT_READ);
                 if (ret) return ret;
             }
         }
         if (type & AT_ENTER_CMD_XIP) {
+#ifdef USE_CURRENT_UF2
+            _flash_serial = false;
+#endif
             ret = flash_funcs->do_flash_enter_cmd_xip();
+            TASK_STATS_RECORD(AT_ENTER_CMD_XIP);
             if (ret) return ret;
         }
     }
@@ -234,11 +930,17 @@ void queue_task(struct async_task_queue *queue, struct async_task *task, async_t
     task->result = _execute_task(task);
     _call_task_complete(task);
 #else
-    if (queue->full) {
+#if defined(ASYNC_TASK_SCHEDULER) || defined(USE_TASK_STATS)
+    task->queued_time = time_us_32();
+#endif
+    uint8_t head = queue->head;
+    if (async_task_queue_full(queue)) {
         usb_warn("overwriting already queued task for queue %p\n", queue);
+        head--;
     }
-    _task_copy(&queue->task, task);
-    queue->full = true;
+    _task_copy(&queue->tasks[head & (ASYNC_TASK_QUEUE_DEPTH - 1u)], task);
+    __mem_fence_release();
+    queue->head = head + 1u;
     __sev();
 #endif
 }
@@ -256,26 +958,72 @@ bool dequeue_task(struct async_task_queue *queue, struct async_task *task_out) {
     return false;
 #else
     bool have_task = false;
-    uint32_t save = save_and_disable_interrupts();
+    uint32_t save = _worker_disable_interrupts();
     __mem_fence_acquire();
-    if (queue->full) {
-        _task_copy(task_out, &queue->task);
-        queue->full = false;
+    uint8_t tail = queue->tail;
+    if (tail != queue->head) {
+        _task_copy(task_out, &queue->tasks[tail & (ASYNC_TASK_QUEUE_DEPTH - 1u)]);
+        queue->tail = tail + 1u;
         have_task = true;
     }
-    restore_interrupts(save);
+    _worker_restore_interrupts(save);
     return have_task;
 #endif
 }
 
-void execute_task(struct async_task_queue *queue, struct async_task *task) {
+#ifdef USE_BATCHED_TASK_COMPLETION
+// tasks whose callbacks are yet to be called; the worker is the producer and the USB IRQ the consumer
+static struct async_task_queue _completed_tasks;
+
+void async_task_complete_batch() {
+#ifdef USE_TASK_STATS
+    uint32_t start = time_us_32();
+#endif
+    __mem_fence_acquire();
+    uint8_t tail = _completed_tasks.tail;
+    uint8_t head = _completed_tasks.head;
+    if (tail == head) return;
+    do {
+        _call_task_complete(&_completed_tasks.tasks[tail & (ASYNC_TASK_QUEUE_DEPTH - 1u)]);
+    } while (++tail != head);
+    _completed_tasks.tail = tail;
+#ifdef USE_TASK_STATS
+    _record_task_stats(ASYNC_TASK_STATS_COMPLETE_BATCH, start);
+#endif
+}
+#endif
+
+// execute and complete a task; this is all there is to it for one which was never queued (i.e. an erase ahead task)
+static void _execute_unqueued_task(struct async_task_queue *queue, struct async_task *task) {
     if (queue->disable)
         task->result = 1; // todo better code (this is fine for now since we only ever disable virtual_disk queue which only cares where or not result is 0
     else
         task->result = _execute_task(task);
-    uint32_t save = save_and_disable_interrupts();
+#ifdef USE_BATCHED_TASK_COMPLETION
+    if (!async_task_queue_full(&_completed_tasks)) {
+        uint8_t head = _completed_tasks.head;
+        _task_copy(&_completed_tasks.tasks[head & (ASYNC_TASK_QUEUE_DEPTH - 1u)], task);
+        __mem_fence_release();
+        _completed_tasks.head = head + 1u;
+        interrupt_set_pending(USBCTRL_IRQ);
+        return;
+    }
+    // the USB IRQ hasn't drained the ring (which it will have unless it is disabled), so do it here, keeping the
+    // callbacks in order
+#endif
+    uint32_t save = _worker_disable_interrupts();
+#ifdef USE_BATCHED_TASK_COMPLETION
+    async_task_complete_batch();
+#endif
     _call_task_complete(task);
-    restore_interrupts(save);
+    _worker_restore_interrupts(save);
+}
+
+void execute_task(struct async_task_queue *queue, struct async_task *task) {
+#ifdef USE_TASK_STATS
+    _record_task_stats(ASYNC_TASK_STATS_QUEUE_WAIT, task->queued_time);
+#endif
+    _execute_unqueued_task(queue, task);
 }
 
 struct async_task_queue virtual_disk_queue;
@@ -286,12 +1034,67 @@ static bool _worker_started;
 
 static struct async_task _worker_task;
 
+#ifdef ASYNC_TASK_SCHEDULER
+static const struct async_task_queue_schedule {
+    struct async_task_queue *queue;
+    uint32_t priority_us; // priority expressed as the equivalent time waited
+    uint32_t latency_budget_us;
+} _queue_schedules[] = {
+        {&virtual_disk_queue, VIRTUAL_DISK_QUEUE_PRIORITY * ASYNC_TASK_AGING_US, VIRTUAL_DISK_QUEUE_LATENCY_BUDGET_US},
+#ifdef USE_PICOBOOT
+        {&picoboot_queue,     PICOBOOT_QUEUE_PRIORITY * ASYNC_TASK_AGING_US,     PICOBOOT_QUEUE_LATENCY_BUDGET_US},
+#endif
+};
+
+// returns the queue to run the next task from, or NULL if they are all empty
+static struct async_task_queue *_schedule_next_queue() {
+    struct async_task_queue *next = NULL;
+    uint32_t best_score = 0;
+    uint32_t now = time_us_32();
+    for (uint i = 0; i < count_of(_queue_schedules); i++) {
+        struct async_task_queue *queue = _queue_schedules[i].queue;
+        if (!async_task_queue_count(queue)) continue;
+        // note the IRQ may reset the queue under us, in which case this is stale, but dequeue_task will notice
+        uint32_t waited = now - queue->tasks[queue->tail & (ASYNC_TASK_QUEUE_DEPTH - 1u)].queued_time;
+        uint32_t score = MIN(waited, 1u << 30) + _queue_schedules[i].priority_us;
+        if (waited > _queue_schedules[i].latency_budget_us) {
+            score |= 1u << 31;
+        }
+        if (!next || score > best_score) {
+            next = queue;
+            best_score = score;
+        }
+    }
+    return next;
+}
+#endif
+
 void __attribute__((noreturn)) async_task_worker() {
     flash_funcs = &default_flash_funcs;
 #ifndef NDEBUG
     _worker_started = true;
+#endif
+#ifdef USE_CURRENT_UF2
+    // size the flash for CURRENT.UF2, which is well before the host can have enumerated us and read the directory
+    if (!flash_funcs->do_flash_exit_xip()) {
+        _flash_serial = true;
+#ifdef USE_FLASH_GEOMETRY
+        int size_log2 = async_task_flash_geometry.size_log2;
+#else
+        int size_log2 = flash_size_log2();
+#endif
+        if (size_log2 >= FLASH_SECTOR_ERASE_SIZE_LOG2) {
+            async_task_flash_size_log2 = (uint8_t) MIN(size_log2, 24);
+        }
+    }
 #endif
     do {
+#ifdef ASYNC_TASK_SCHEDULER
+        struct async_task_queue *queue = _schedule_next_queue();
+        if (queue && dequeue_task(queue, &_worker_task)) {
+            execute_task(queue, &_worker_task);
+        }
+#else
         if (dequeue_task(&virtual_disk_queue, &_worker_task)) {
             execute_task(&virtual_disk_queue, &_worker_task);
         }
@@ -299,8 +1102,18 @@ void __attribute__((noreturn)) async_task_worker() {
         else if (dequeue_task(&picoboot_queue, &_worker_task)) {
             execute_task(&picoboot_queue, &_worker_task);
         }
+#endif
 #endif
         else {
+#ifdef USE_UF2_ERASE_AHEAD
+            uint32_t save = _worker_disable_interrupts();
+            bool erase_ahead = vd_erase_ahead_task(&_worker_task);
+            _worker_restore_interrupts(save);
+            if (erase_ahead) {
+                _execute_unqueued_task(&virtual_disk_queue, &_worker_task);
+                continue;
+            }
+#endif
             __wfe();
         }
     } while (true);
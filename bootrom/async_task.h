@@ -22,6 +22,13 @@
 #define AT_EXEC             0x40u
 #define AT_VECTORIZE_FLASH  0x80u
 
+// (for the flash features which imply USE_FLASH_GEOMETRY)
+#include "program_flash_generic.h"
+#if defined(USE_FLASH_GEOMETRY) && !defined(USE_FLASH_BLOCK_ERASE)
+// block erases are chosen from the flash geometry
+#define USE_FLASH_BLOCK_ERASE
+#endif
+
 struct async_task;
 
 typedef void (*async_task_callback)(struct async_task *task);
@@ -29,6 +36,9 @@ typedef void (*async_task_callback)(struct async_task *task);
 #define FLASH_PAGE_SIZE 256u
 #define FLASH_PAGE_MASK (FLASH_PAGE_SIZE - 1u)
 #define FLASH_SECTOR_ERASE_SIZE 4096u
+#define FLASH_SECTOR_ERASE_SIZE_LOG2 12u
+#define FLASH_BLOCK_ERASE_SIZE_32K 32768u
+#define FLASH_BLOCK_ERASE_SIZE_64K 65536u
 
 enum task_source {
     TASK_SOURCE_VIRTUAL_DISK = 1,
@@ -54,16 +64,54 @@ struct async_task {
     uint8_t source;
     // if true, fail the task if the source isn't the same as the last source that did a mutation
     bool check_last_mutation_source;
+#ifdef USE_UF2_PAGE_ASSEMBLY
+    // if true, a virtual disk write also programs any partially assembled pages (set for the last block of a UF2)
+    bool flush_uf2_pages;
+#endif
+#if defined(ASYNC_TASK_SCHEDULER) || defined(USE_TASK_STATS)
+    // time_us_32() when the task was queued
+    uint32_t queued_time;
+#endif
 };
 
-// arguably a very short queue; there is only one up "next" item which is set by queue_task...
-// attempt to queue multiple items will overwrite (so generally use multiple queues)
+// number of tasks each queue can hold; must be a power of 2. The default of 1 is the original single "next" item,
+// larger values allow the IRQ side to run several tasks (e.g. flash pages) ahead of the worker
+#ifndef ASYNC_TASK_QUEUE_DEPTH
+#define ASYNC_TASK_QUEUE_DEPTH 1
+#endif
+static_assert(ASYNC_TASK_QUEUE_DEPTH && !(ASYNC_TASK_QUEUE_DEPTH & (ASYNC_TASK_QUEUE_DEPTH - 1)), "");
+static_assert(ASYNC_TASK_QUEUE_DEPTH <= 128, "");
+
+#ifdef ASYNC_TASK_SCHEDULER
+// Rather than always draining the virtual disk queue first, the worker runs the oldest task from the queue with the
+// highest effective priority: a queue's priority goes up by one for every ASYNC_TASK_AGING_US its oldest task has been
+// waiting, and a queue whose oldest task has waited longer than its latency budget takes precedence over one that hasn't
+#ifndef ASYNC_TASK_AGING_US
+#define ASYNC_TASK_AGING_US 1000u
+#endif
+#ifndef VIRTUAL_DISK_QUEUE_PRIORITY
+#define VIRTUAL_DISK_QUEUE_PRIORITY 0u
+#endif
+#ifndef VIRTUAL_DISK_QUEUE_LATENCY_BUDGET_US
+#define VIRTUAL_DISK_QUEUE_LATENCY_BUDGET_US 100000u
+#endif
+#ifndef PICOBOOT_QUEUE_PRIORITY
+#define PICOBOOT_QUEUE_PRIORITY 10u
+#endif
+#ifndef PICOBOOT_QUEUE_LATENCY_BUDGET_US
+#define PICOBOOT_QUEUE_LATENCY_BUDGET_US 20000u
+#endif
+#endif
+
+// fixed capacity ring of tasks with a single producer (IRQ scope via queue_task) and a single consumer (the worker via
+// dequeue_task). head and tail are free running, and only ever advanced by the producer and consumer respectively.
 //
-// this purely allows us to queue one task from the IRQ scope to the worker scope while
-// that worker scope may still be executing the last one
+// an attempt to queue to a full queue will overwrite the most recently queued item, so callers that want to
+// keep multiple tasks in flight should check async_task_queue_full() first (and hold off the host if so)
 struct async_task_queue {
-    struct async_task task;
-    volatile bool full;
+    struct async_task tasks[ASYNC_TASK_QUEUE_DEPTH];
+    volatile uint8_t head;
+    volatile uint8_t tail;
     volatile bool disable;
 };
 
@@ -76,6 +124,13 @@ bool dequeue_task(struct async_task_queue *queue, struct async_task *task_out);
 // runs forever dispatch tasks
 void __attribute__((noreturn)) async_task_worker();
 
+#ifdef USE_BATCHED_TASK_COMPLETION
+// Rather than calling each task's completion callback itself with IRQs disabled, the worker posts completed tasks to a
+// ring and pends the USB IRQ, whose handler calls this to run the callbacks for every task posted so far. The worker
+// then only ever masks IRQs for as long as it takes to dequeue a task
+void async_task_complete_batch();
+#endif
+
 void reset_task(struct async_task *task);
 
 extern struct async_task_queue virtual_disk_queue;
@@ -85,8 +140,17 @@ static inline void async_disable_queue(struct async_task_queue *queue, bool disa
     queue->disable = disable;
 }
 
+static inline uint async_task_queue_count(struct async_task_queue *queue) {
+    return (uint8_t) (queue->head - queue->tail);
+}
+
+static inline bool async_task_queue_full(struct async_task_queue *queue) {
+    return async_task_queue_count(queue) >= ASYNC_TASK_QUEUE_DEPTH;
+}
+
+// called by irq handler; note dequeue_task copies out with IRQs disabled, so it is safe to discard from here
 static inline void reset_queue(struct async_task_queue *queue) {
-    queue->full = false;
+    queue->tail = queue->head;
     async_disable_queue(queue, false);
 }
 
@@ -96,6 +160,144 @@ static inline void reset_queue(struct async_task_queue *queue) {
 #else
 #define FLASH_VALID_BLOCKS_BASE (SRAM_BASE + 96 * 1024)
 #endif
-#define FLASH_BITMAPS_SIZE (XIP_SRAM_END - XIP_SRAM_BASE)
+#ifdef USE_DIFFERENTIAL_FLASH
+// differential flashing takes the end of the bitmap area for a copy of a sector and a page to compare against
+#define DIFF_FLASH_BUFFER_SIZE (FLASH_SECTOR_ERASE_SIZE + FLASH_PAGE_SIZE)
+#else
+#define DIFF_FLASH_BUFFER_SIZE 0
+#endif
+#ifdef USE_FLASH_VERIFY
+// and flash verify takes a page after that to read back into
+#define FLASH_VERIFY_BUFFER_SIZE FLASH_PAGE_SIZE
+#else
+#define FLASH_VERIFY_BUFFER_SIZE 0
+#endif
+#ifdef USE_UF2_PAGE_ASSEMBLY
+// and UF2 page assembly takes UF2_ASSEMBLY_PAGES pages after that, in which the worker builds up flash pages from
+// UF2 payloads which don't line up with them
+#ifndef UF2_ASSEMBLY_PAGES
+#define UF2_ASSEMBLY_PAGES 4u
+#endif
+#define UF2_ASSEMBLY_BUFFER_SIZE (UF2_ASSEMBLY_PAGES * FLASH_PAGE_SIZE)
+#else
+#define UF2_ASSEMBLY_BUFFER_SIZE 0
+#endif
+#ifdef USE_VD_SECTOR_CACHE
+// and the virtual disk's sector cache takes VD_SECTOR_CACHE_SECTORS (MSC) sectors after that for the sectors' data
+#ifndef VD_SECTOR_CACHE_SECTORS
+#define VD_SECTOR_CACHE_SECTORS 4u
+#endif
+#define VD_SECTOR_CACHE_BUFFER_SIZE (VD_SECTOR_CACHE_SECTORS * 512u)
+#else
+#define VD_SECTOR_CACHE_BUFFER_SIZE 0
+#endif
+#define FLASH_BITMAPS_SIZE (XIP_SRAM_END - XIP_SRAM_BASE - DIFF_FLASH_BUFFER_SIZE - FLASH_VERIFY_BUFFER_SIZE - \
+                            UF2_ASSEMBLY_BUFFER_SIZE - VD_SECTOR_CACHE_BUFFER_SIZE)
+#define DIFF_FLASH_BUFFER_BASE (FLASH_VALID_BLOCKS_BASE + FLASH_BITMAPS_SIZE)
+#define FLASH_VERIFY_BUFFER_BASE (DIFF_FLASH_BUFFER_BASE + DIFF_FLASH_BUFFER_SIZE)
+#define UF2_ASSEMBLY_BUFFER_BASE (FLASH_VERIFY_BUFFER_BASE + FLASH_VERIFY_BUFFER_SIZE)
+#define VD_SECTOR_CACHE_BUFFER_BASE (UF2_ASSEMBLY_BUFFER_BASE + UF2_ASSEMBLY_BUFFER_SIZE)
+
+#ifdef USE_FLASH_ERASE_SUSPEND
+// USE_FLASH_ERASE_SUSPEND: while a flash erase is in progress, the worker suspends it (if SFDP says the flash can) to
+// run a PICOBOOT read of flash outside the area being erased, so read latency isn't bounded by a 64K block erase
+#ifndef FLASH_ERASE_SUSPEND_MIN_RUN_US
+#define FLASH_ERASE_SUSPEND_MIN_RUN_US 1000u
+#endif
+#endif
+
+// USE_FLASH_DMA: flash page program and read (and the fast and SFDP reads) move their data with DMA rather than
+// CPU polling of the SSI FIFOs
+
+// USE_FLASH_WORD_READS: serial flash reads of a multiple of 4 bytes switch the SSI to 32-bit frames after the command and
+// address, for 4x fewer FIFO accesses. This is in flash_read_data() itself, so also applies to the boot2 load in
+// _flash_boot(); reads done with DMA are unaffected
+
+// USE_FLASH_FAST_READ: flash page reads and command mode XIP use 0Bh fast reads rather than 03h, which many parts only
+// support up to 33-50MHz
+
+#ifdef USE_FLASH_BAUD_CALIBRATION
+// On the first exit XIP, the worker steps the SSI clock divider down from FLASH_BAUD_DIV_DEFAULT while the start of
+// the flash reads back FLASH_BAUD_CAL_READS times the same as at the default rate, then backs off by
+// FLASH_BAUD_CAL_MARGIN (in divider units) from the fastest rate that passed. The result is used for the rest of the
+// session. The reads use the same command as flash page reads (0Bh with USE_FLASH_FAST_READ, otherwise 03h). If the
+// start of the flash is all one byte value, fast reads calibrate on the flash's SFDP header (5Ah, which also has a
+// dummy byte) instead, and 03h reads aren't calibrated
+#ifndef FLASH_BAUD_CAL_READS
+#define FLASH_BAUD_CAL_READS 4u
+#endif
+#ifndef FLASH_BAUD_CAL_MARGIN
+#define FLASH_BAUD_CAL_MARGIN 2u
+#endif
+static_assert(!(FLASH_BAUD_CAL_MARGIN & 1u), "");
+#endif
+
+#ifdef USE_CURRENT_UF2
+// log2 of the flash size in bytes (at most that of the XIP window), read by the worker when it starts; 0 if unknown
+extern uint8_t async_task_flash_size_log2;
+#endif
+
+#ifdef USE_FLASH_GEOMETRY
+// the flash's geometry, read by the worker on exit XIP (all zero before then). Erases use the largest of its erase
+// types that fit; FLASH_SECTOR_ERASE_SIZE remains the granularity everything else works in
+extern struct flash_geometry async_task_flash_geometry;
+#endif
+
+#ifdef USE_TASK_STATS
+// timings are in microseconds
+struct async_task_stats {
+    uint32_t count;
+    uint32_t total_us;
+    uint32_t min_us;
+    uint32_t max_us;
+};
+static_assert(sizeof(struct async_task_stats) == 16, "");
+
+// there is an entry for each task type indexed by the bit number of its AT_ flag (not counting any time an erase spends
+// suspended running PICOBOOT reads, which count as reads), followed by one for the time tasks spend queued before they
+// are executed (erase ahead tasks, which the worker builds when idle, aren't queued), one for the time the worker runs
+// with IRQs disabled, and one for the time spent running batches of completion callbacks (from the USB IRQ, or failing
+// that with IRQs disabled, in which case it is part of the previous entry too)
+#define ASYNC_TASK_STATS_QUEUE_WAIT 8
+#define ASYNC_TASK_STATS_IRQS_DISABLED 9
+#define ASYNC_TASK_STATS_COMPLETE_BATCH 10
+#define ASYNC_TASK_STATS_COUNT 11
+extern struct async_task_stats async_task_stats[ASYNC_TASK_STATS_COUNT];
+#endif
+
+#ifdef USE_PICOBOOT_RESUME
+// progress of the PICOBOOT command the worker most recently executed. This is not cleared by a PICOBOOT reset (and hence
+// flash_abort), so the host can resume an interrupted erase or write from where it got to. Only erases and programs
+// which completed before any abort count
+struct async_task_progress {
+    uint32_t token; // the host's dToken for the command
+    uint32_t erase_end; // the command's range is erased up to (but not including) this address
+    uint32_t program_end; // the command's range is written up to (but not including) this address
+};
+static_assert(sizeof(struct async_task_progress) == 12, "");
+extern struct async_task_progress async_task_progress;
+#endif
+
+#ifdef USE_FLASH_VERIFY
+// USE_FLASH_VERIFY: every flash page program is read back (with the same read the worker uses for everything else, so
+// quad or fast if enabled) and compared, failing the task with PICOBOOT_UNKNOWN_ERROR on a mismatch. The data of each
+// successful flash write is also folded into a CRC32, so the host can check a whole image without reading it back
+struct flash_verify_status {
+    uint32_t crc; // bootrom_crc32 (seeded with 0xffffffff) of the data of the flash writes since the last exit XIP, in order
+    uint32_t length; // number of bytes covered by crc
+    uint32_t mismatches; // pages which did not read back as programmed
+    uint32_t first_mismatch_addr; // 0 if none
+};
+static_assert(sizeof(struct flash_verify_status) == 16, "");
+extern struct flash_verify_status flash_verify_status;
+#endif
+
+#ifdef USE_DIFFERENTIAL_FLASH
+struct diff_flash_stats {
+    uint32_t erases_skipped; // in sectors
+    uint32_t programs_skipped; // in pages
+};
+extern struct diff_flash_stats diff_flash_stats;
+#endif
 
 #endif //ASYNC_TASK_H_
@@ -10,5 +10,13 @@
 #include "pico/types.h"
 
 uint32_t crc32_small(const uint8_t *buf, unsigned int len, uint32_t seed);
+uint32_t crc32_nibble(const uint8_t *buf, unsigned int len, uint32_t seed);
+
+// the CRC32 the bootrom uses itself
+#ifdef USE_CRC32_NIBBLE_TABLE
+#define bootrom_crc32 crc32_nibble
+#else
+#define bootrom_crc32 crc32_small
+#endif
 
 #endif
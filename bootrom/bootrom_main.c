@@ -72,7 +72,7 @@ static void _flash_boot() {
         ssi->ssienr = 1;
 
         flash_read_data(BOOT2_FLASH_OFFS, boot2_load, BOOT2_SIZE_BYTES);
-        uint32_t sum = crc32_small(boot2_load, BOOT2_SIZE_BYTES - 4, 0xffffffff);
+        uint32_t sum = bootrom_crc32(boot2_load, BOOT2_SIZE_BYTES - 4, 0xffffffff);
         if (sum == *(uint32_t *) (boot2_load + BOOT2_SIZE_BYTES - 4))
             break;
     }
@@ -0,0 +1,138 @@
+/**
+ * Copyright (c) 2020 Raspberry Pi (Trading) Ltd.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include "pico.h"
+#include "program_flash_generic.h"
+
+#ifdef USE_FLASH_GEOMETRY
+// ----------------------------------------------------------------------------
+// SFDP basic flash parameter table (JESD216) parsing. This only talks to the flash via flash_read_sfdp() and
+// flash_size_log2(), so doesn't touch the SSI itself
+
+#define FLASHCMD_SECTOR_ERASE     0x20
+
+// the words of the table we look at; the table is 9 words in JESD216, 16 in JESD216B
+#define BFPT_WORDS 16
+
+static inline __attribute__((always_inline)) uint32_t bytes_to_u32le(const uint8_t *b) {
+    return b[0] | (b[1] << 8) | (b[2] << 16) | (b[3] << 24);
+}
+
+// Find the mandatory (JEDEC basic flash) parameter table.
+// Return value > 0: its SFDP address, with its length in words in *len_words
+// Return value 0: no SFDP
+uint32_t __noinline flash_find_sfdp_bfpt(uint *len_words) {
+    uint8_t rxbuf[16];
+
+    // Check magic
+    flash_read_sfdp(0, rxbuf, 16);
+    if (bytes_to_u32le(rxbuf) != ('S' | ('F' << 8) | ('D' << 16) | ('P' << 24)))
+        return 0;
+    // Skip NPH -- we don't care about nonmandatory parameters.
+    // Offset 8 is header for mandatory parameter table
+    // | ID | MinRev | MajRev | Length in words | ptr[2] | ptr[1] | ptr[0] | unused|
+    // ID must be 0 (JEDEC) for mandatory PTH
+    if (rxbuf[8] != 0)
+        return 0;
+    *len_words = rxbuf[11];
+    return bytes_to_u32le(rxbuf + 12) & 0xffffffu;
+}
+
+// Typical erase times are 5-bit counts of 2-bit units
+static uint16_t erase_time_ms(uint32_t field) {
+    static const uint16_t units_ms[4] = {1, 16, 128, 1000};
+    return ((field & 0x1fu) + 1) * units_ms[(field >> 5u) & 3u];
+}
+
+// Fill in geometry from SFDP, or with conservative defaults (just the 4K sector erase and 3-byte addressing) for
+// anything SFDP doesn't tell us.
+// Return value true: the flash has SFDP
+bool __noinline flash_read_geometry(struct flash_geometry *geometry) {
+    uint32_t bfpt[BFPT_WORDS];
+    uint len_words;
+
+    static_assert(!(sizeof(*geometry) & 3u), "");
+    for (uint i = 0; i < sizeof(*geometry) / 4; i++)
+        ((uint32_t *) geometry)[i] = 0;
+    int size_log2 = flash_size_log2();
+    if (size_log2 > 0)
+        geometry->size_log2 = size_log2;
+    geometry->page_size_log2 = 8;
+    geometry->addr_modes = FLASH_ADDR_3_BYTE;
+    geometry->qer = FLASH_QER_UNKNOWN;
+    geometry->erase_types[0].size_log2 = 12;
+    geometry->erase_types[0].cmd = FLASHCMD_SECTOR_ERASE;
+
+    uint32_t param_table_ptr = flash_find_sfdp_bfpt(&len_words);
+    // Erase types are in word 7 and 8
+    if (!param_table_ptr || len_words < 9)
+        return false;
+    if (len_words > BFPT_WORDS)
+        len_words = BFPT_WORDS;
+    flash_read_sfdp(param_table_ptr, (uint8_t *) bfpt, len_words * 4);
+    for (uint i = len_words; i < BFPT_WORDS; i++)
+        bfpt[i] = 0;
+    // (the RP2040 is little endian like SFDP, so the words can be used as is)
+    geometry->sfdp = true;
+
+    // Word 0: bits 18:17 address bytes, bit 21 1-4-4 read, bit 22 1-1-4 read
+    static_assert(FLASH_ADDR_3_BYTE == 1 && FLASH_ADDR_4_BYTE == 2, "");
+    static const uint8_t addr_modes[4] = {FLASH_ADDR_3_BYTE, FLASH_ADDR_3_BYTE | FLASH_ADDR_4_BYTE, FLASH_ADDR_4_BYTE,
+                                          FLASH_ADDR_3_BYTE};
+    geometry->addr_modes = addr_modes[(bfpt[0] >> 17u) & 3u];
+    // Word 2: 1-4-4 read in bits 15:0, 1-1-4 read in bits 31:16, each as command, mode clocks (3 bits) and wait
+    // states (5 bits)
+    if (bfpt[0] & (1u << 21u)) {
+        geometry->quad_io_read_cmd = bfpt[2] >> 8u;
+        geometry->quad_io_read_dummy_clocks = ((bfpt[2] >> 5u) & 7u) + (bfpt[2] & 0x1fu);
+    }
+    if (bfpt[0] & (1u << 22u)) {
+        geometry->quad_out_read_cmd = bfpt[2] >> 24u;
+        geometry->quad_out_read_dummy_clocks = ((bfpt[2] >> 21u) & 7u) + ((bfpt[2] >> 16u) & 0x1fu);
+    }
+
+    // Words 7 and 8: four erase types as size (log2) and command. Insert in size order
+    uint n = 0;
+    for (uint i = 0; i < FLASH_ERASE_TYPES; i++) {
+        uint32_t type = bfpt[7 + i / 2] >> (16u * (i & 1u));
+        uint8_t type_size_log2 = (uint8_t) type;
+        if (!type_size_log2)
+            continue;
+        struct flash_erase_type *et = geometry->erase_types + n;
+        while (et > geometry->erase_types && et[-1].size_log2 > type_size_log2) {
+            et[0] = et[-1];
+            et--;
+        }
+        et->size_log2 = type_size_log2;
+        et->cmd = (uint8_t) (type >> 8u);
+        // Word 9: typical erase times in bits 10:4, 17:11, 24:18 and 31:25
+        et->typ_ms = len_words > 9 ? erase_time_ms(bfpt[9] >> (4u + 7u * i)) : 0;
+        n++;
+    }
+    if (!n) {
+        // keep the default sector erase
+        geometry->erase_types[0].size_log2 = 12;
+        geometry->erase_types[0].cmd = FLASHCMD_SECTOR_ERASE;
+    }
+
+    // Word 10: bits 7:4 page size (log2), bits 13:8 typical page program time as a 5-bit count of 8us or 64us units
+    if (len_words > 10 && (bfpt[10] & 0xf0u)) {
+        geometry->page_size_log2 = (bfpt[10] >> 4u) & 0xfu;
+        geometry->page_program_typ_us = (((bfpt[10] >> 8u) & 0x1fu) + 1) * ((bfpt[10] & (1u << 13u)) ? 64 : 8);
+    }
+
+    // Word 11: bit 31 clear if suspend/resume is supported. Word 12: bits 31:24 erase suspend, bits 23:16 erase resume
+    if (len_words > 12 && !(bfpt[11] & (1u << 31u))) {
+        geometry->erase_suspend_cmd = bfpt[12] >> 24u;
+        geometry->erase_resume_cmd = bfpt[12] >> 16u;
+    }
+
+    // Word 14: bits 22:20 quad enable requirements
+    if (len_words > 14)
+        geometry->qer = (bfpt[14] >> 20u) & 7u;
+    return true;
+}
+#endif
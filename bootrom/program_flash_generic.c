@@ -9,6 +9,11 @@
 #include "hardware/structs/ssi.h"
 #include "hardware/structs/xip_ctrl.h"
 #include "hardware/resets.h"
+#include "hardware/sync.h"
+#ifdef USE_FLASH_DMA
+#include "hardware/regs/dreq.h"
+#include "hardware/structs/dma.h"
+#endif
 #include "program_flash_generic.h"
 #include "resets.h"
 
@@ -17,10 +22,50 @@
 #define FLASHCMD_READ_DATA        0x03
 #define FLASHCMD_READ_STATUS      0x05
 #define FLASHCMD_WRITE_ENABLE     0x06
+#define FLASHCMD_FAST_READ        0x0b
 #define FLASHCMD_SECTOR_ERASE     0x20
 #define FLASHCMD_READ_SFDP        0x5a
 #define FLASHCMD_READ_JEDEC_ID    0x9f
 
+// These are supported by most flash with quad IO; the quad read command comes from SFDP
+#define FLASHCMD_WRITE_STATUS     0x01
+#define FLASHCMD_QUAD_PAGE_PROGRAM 0x32
+#define FLASHCMD_WRITE_STATUS2    0x31
+#define FLASHCMD_READ_STATUS2     0x35
+
+#ifdef USE_FLASH_4_BYTE_ADDR
+// Flash larger than 16MB has versions of the address-taking commands with a 4-byte address, which work whatever
+// address mode the flash is in. These are used for addresses beyond the first 16MB, so the exported functions behave
+// exactly as before for everything else (and there is no 4-byte address mode state to get out of step with boot2)
+static const uint8_t flash_cmds_4_byte_addr[][2] = {
+        {FLASHCMD_PAGE_PROGRAM,      0x12},
+        {FLASHCMD_READ_DATA,         0x13},
+        {FLASHCMD_FAST_READ,         0x0c},
+        {FLASHCMD_SECTOR_ERASE,      0x21},
+        {0x52,                       0x5c}, // 32K block erase
+        {0xd8,                       0xdc}, // 64K block erase
+        {FLASHCMD_QUAD_PAGE_PROGRAM, 0x34},
+        {0x6b,                       0x6c}, // 1-1-4 read
+};
+
+// Return the 4-byte address version of cmd, or 0 if we don't know of one (sending cmd itself with a 4-byte address
+// would be taken as a 3-byte address followed by data, so could erase or program the wrong place)
+static uint8_t __noinline flash_cmd_4_byte_addr(uint8_t cmd) {
+    for (uint i = 0; i < sizeof(flash_cmds_4_byte_addr) / 2; i++) {
+        if (flash_cmds_4_byte_addr[i][0] == cmd)
+            return flash_cmds_4_byte_addr[i][1];
+    }
+    return 0;
+}
+#define flash_addr_is_4_byte(addr) ((addr) >= 0x1000000)
+
+bool flash_cmd_addr_ok(uint8_t cmd, uint32_t addr) {
+    return !flash_addr_is_4_byte(addr) || flash_cmd_4_byte_addr(cmd);
+}
+#else
+#define flash_addr_is_4_byte(addr) false
+#endif
+
 // Annoyingly, structs give much better code generation, as they re-use the base
 // pointer rather than doing a PC-relative load for each constant pointer.
 
@@ -43,7 +88,7 @@ void __noinline connect_internal_flash() {
 
     // Then mux XIP block onto internal QSPI flash pads
     io_rw_32 *iobank1 = (io_rw_32 *) IO_QSPI_BASE;
-#ifndef GENERAL_SIZE_HACKS
+#if !defined(GENERAL_SIZE_HACKS) || !defined(__arm__)
     for (int i = 0; i < 6; ++i)
         iobank1[2 * i + 1] = 0;
 #else
@@ -69,7 +114,7 @@ void flash_init_spi() {
     (void) ssi->sr;
     (void) ssi->icr;
     // Hopefully-conservative baud rate for boot and programming
-    ssi->baudr = 6;
+    ssi->baudr = FLASH_BAUD_DIV_DEFAULT;
     ssi->ctrlr0 =
             (SSI_CTRLR0_SPI_FRF_VALUE_STD << SSI_CTRLR0_SPI_FRF_LSB) | // Standard 1-bit SPI serial frames
             (7 << SSI_CTRLR0_DFS_32_LSB) | // 8 clocks per data frame
@@ -80,6 +125,14 @@ void flash_init_spi() {
     ssi->ssienr = 1;
 }
 
+// Change the SSI clock divider (which must be even) from the one flash_init_spi() chose, e.g. once it has been found
+// that the flash can be read reliably at a higher rate
+void __noinline flash_set_baud_div(uint div) {
+    ssi->ssienr = 0;
+    ssi->baudr = div;
+    ssi->ssienr = 1;
+}
+
 typedef enum {
     OUTOVER_NORMAL = 0,
     OUTOVER_INVERT,
@@ -155,15 +208,91 @@ void flash_do_cmd(uint8_t cmd, const uint8_t *tx, uint8_t *rx, size_t count) {
     flash_put_get(tx, rx, count, 1);
 }
 
+#ifdef USE_FLASH_DMA
+// As flash_put_get, but with two DMA channels moving the data to and from the SSI, paced by its DREQs. Unlike
+// flash_put_get this can't fall behind and overflow the RX FIFO, however long we are interrupted for, so
+// there is no limit on data in flight. An abort stops both channels.
+//
+// This is only for the bootrom's own (USB boot) flash access: the functions exported to user code must leave the DMA
+// alone.
+void __noinline flash_put_get_dma(const uint8_t *tx, uint8_t *rx, size_t count, size_t rx_skip) {
+    uint32_t zero = 0;
+    uint32_t discard;
+    // The command/address bytes come back first
+    while (rx_skip && !flash_was_aborted()) {
+        if (ssi->rxflr) {
+            (void) ssi->dr0;
+            --rx_skip;
+        }
+    }
+    if (count && !rx_skip) {
+        unreset_block_wait_noinline(RESETS_RESET_DMA_BITS);
+        dma_channel_hw_t *tx_chan = &dma_hw->ch[FLASH_DMA_CHANNEL_TX];
+        dma_channel_hw_t *rx_chan = &dma_hw->ch[FLASH_DMA_CHANNEL_RX];
+        ssi->dmatdlr = 4;
+        ssi->dmardlr = 0;
+        ssi->dmacr = SSI_DMACR_TDMAE_BITS | SSI_DMACR_RDMAE_BITS;
+        // Chaining a channel to itself disables chaining
+        rx_chan->read_addr = (uintptr_t) &ssi->dr0;
+        rx_chan->write_addr = (uintptr_t) (rx ? rx : (uint8_t *) &discard);
+        rx_chan->transfer_count = count;
+        rx_chan->ctrl_trig =
+                (rx ? DMA_CH0_CTRL_TRIG_INCR_WRITE_BITS : 0) |
+                (DREQ_XIP_SSIRX << DMA_CH0_CTRL_TRIG_TREQ_SEL_LSB) |
+                (FLASH_DMA_CHANNEL_RX << DMA_CH0_CTRL_TRIG_CHAIN_TO_LSB) |
+                (DMA_CH0_CTRL_TRIG_DATA_SIZE_VALUE_SIZE_BYTE << DMA_CH0_CTRL_TRIG_DATA_SIZE_LSB) |
+                DMA_CH0_CTRL_TRIG_EN_BITS;
+        tx_chan->read_addr = (uintptr_t) (tx ? tx : (const uint8_t *) &zero);
+        tx_chan->write_addr = (uintptr_t) &ssi->dr0;
+        tx_chan->transfer_count = count;
+        tx_chan->ctrl_trig =
+                (tx ? DMA_CH0_CTRL_TRIG_INCR_READ_BITS : 0) |
+                (DREQ_XIP_SSITX << DMA_CH0_CTRL_TRIG_TREQ_SEL_LSB) |
+                (FLASH_DMA_CHANNEL_TX << DMA_CH0_CTRL_TRIG_CHAIN_TO_LSB) |
+                (DMA_CH0_CTRL_TRIG_DATA_SIZE_VALUE_SIZE_BYTE << DMA_CH0_CTRL_TRIG_DATA_SIZE_LSB) |
+                DMA_CH0_CTRL_TRIG_EN_BITS;
+        // Everything has been received once the RX channel finishes
+        while (rx_chan->ctrl_trig & DMA_CH0_CTRL_TRIG_BUSY_BITS) {
+            if (__builtin_expect(flash_was_aborted(), 0)) {
+                dma_hw->abort = (1u << FLASH_DMA_CHANNEL_TX) | (1u << FLASH_DMA_CHANNEL_RX);
+                while (dma_hw->abort);
+                break;
+            }
+        }
+        ssi->dmacr = 0;
+    }
+    flash_cs_force(OUTOVER_HIGH);
+}
+#endif
+
+static inline __attribute__((always_inline)) uint32_t bytes_to_u32le(const uint8_t *b) {
+    return b[0] | (b[1] << 8) | (b[2] << 16) | (b[3] << 24);
+}
 
 // Timing of this one is critical, so do not expose the symbol to debugger etc
-static inline void flash_put_cmd_addr(uint8_t cmd, uint32_t addr) {
+// Return value: the number of bytes sent, which the caller must skip from the RX FIFO
+static inline size_t flash_put_cmd_addr(uint8_t cmd, uint32_t addr) {
+#ifdef USE_FLASH_4_BYTE_ADDR
+    if (flash_addr_is_4_byte(addr)) {
+        cmd = flash_cmd_4_byte_addr(cmd);
+        // (callers check commands that don't come from the table with flash_cmd_addr_ok)
+        assert(cmd);
+        flash_cs_force(OUTOVER_LOW);
+        ssi->dr0 = cmd;
+        for (int i = 0; i < 4; ++i) {
+            ssi->dr0 = addr >> 24;
+            addr <<= 8;
+        }
+        return 5;
+    }
+#endif
     flash_cs_force(OUTOVER_LOW);
     addr |= cmd << 24;
     for (int i = 0; i < 4; ++i) {
         ssi->dr0 = addr >> 24;
         addr <<= 8;
     }
+    return 4;
 }
 
 // GCC produces some heinous code if we try to loop over the pad controls,
@@ -212,12 +341,17 @@ void __noinline flash_exit_xip() {
 
         // Brief delay (~6000 cyc) for pulls to take effect
         uint32_t delay_cnt = 1u << 11;
+#ifdef __arm__
         asm volatile (
         "1: \n\t"
         "sub %0, %0, #1 \n\t"
         "bne 1b"
         : "+r" (delay_cnt)
         );
+#else
+        // (host builds, i.e. the simulator, have no pulls to wait for)
+        (void) delay_cnt;
+#endif
 
         flash_put_get(NULL, NULL, 4, 0);
 
@@ -265,13 +399,25 @@ static __noinline void flash_enable_write() {
 // Program a 256 byte page at some 256-byte-aligned flash address,
 // from some buffer in memory. Blocks until completion.
 void flash_page_program(uint32_t addr, const uint8_t *data) {
-    assert(addr < 0x1000000);
+    assert(addr < 0x1000000 || flash_addr_is_4_byte(addr));
+    assert(!(addr & 0xffu));
+    flash_enable_write();
+    size_t skip = flash_put_cmd_addr(FLASHCMD_PAGE_PROGRAM, addr);
+    flash_put_get(data, NULL, 256, skip);
+    flash_wait_ready();
+}
+
+#ifdef USE_FLASH_DMA
+// As flash_page_program, using flash_put_get_dma
+void flash_page_program_dma(uint32_t addr, const uint8_t *data) {
+    assert(addr < 0x1000000 || flash_addr_is_4_byte(addr));
     assert(!(addr & 0xffu));
     flash_enable_write();
-    flash_put_cmd_addr(FLASHCMD_PAGE_PROGRAM, addr);
-    flash_put_get(data, NULL, 256, 4);
+    size_t skip = flash_put_cmd_addr(FLASHCMD_PAGE_PROGRAM, addr);
+    flash_put_get_dma(data, NULL, 256, skip);
     flash_wait_ready();
 }
+#endif
 
 // Program a range of flash with some data from memory.
 // Size is rounded up to nearest 256 bytes.
@@ -311,14 +457,36 @@ int flash_was_aborted() {
 
 // Use some other command, supplied by user e.g. a block erase or a chip erase.
 // Despite the name, the user is not erased by this function.
+// Beyond the first 16MB, cmd must have a 4-byte address version (see flash_cmd_addr_ok); if not, nothing is erased.
 void flash_user_erase(uint32_t addr, uint8_t cmd) {
-    assert(addr < 0x1000000);
+    assert(addr < 0x1000000 || flash_addr_is_4_byte(addr));
+    assert(flash_cmd_addr_ok(cmd, addr));
+    if (!flash_cmd_addr_ok(cmd, addr))
+        return;
     flash_enable_write();
-    flash_put_cmd_addr(cmd, addr);
-    flash_put_get(NULL, NULL, 0, 4);
+    size_t skip = flash_put_cmd_addr(cmd, addr);
+    flash_put_get(NULL, NULL, 0, skip);
     flash_wait_ready();
 }
 
+// As flash_user_erase, but return as soon as the erase has started. Poll flash_busy() for completion.
+void flash_user_erase_start(uint32_t addr, uint8_t cmd) {
+    assert(addr < 0x1000000 || flash_addr_is_4_byte(addr));
+    assert(flash_cmd_addr_ok(cmd, addr));
+    if (!flash_cmd_addr_ok(cmd, addr))
+        return;
+    flash_enable_write();
+    size_t skip = flash_put_cmd_addr(cmd, addr);
+    flash_put_get(NULL, NULL, 0, skip);
+}
+
+// Return value true: a program or erase is in progress (and not suspended)
+bool flash_busy() {
+    uint8_t stat;
+    flash_do_cmd(FLASHCMD_READ_STATUS, NULL, &stat, 1);
+    return stat & 0x1;
+}
+
 // Use a standard 20h 4k erase command:
 void flash_sector_erase(uint32_t addr) {
     flash_user_erase(addr, FLASHCMD_SECTOR_ERASE);
@@ -330,10 +498,11 @@ void flash_sector_erase(uint32_t addr) {
 // To use sector-erase only, set block_size to some value larger than flash,
 // e.g. 1ul << 31.
 // To override the default 20h erase cmd, set block_size == 4k.
+// Beyond the first 16MB, sector erases are used instead if block_cmd has no 4-byte address version.
 void __noinline flash_range_erase(uint32_t addr, size_t count, uint32_t block_size, uint8_t block_cmd) {
     uint32_t goal = addr + count;
     while (addr < goal && !flash_was_aborted()) {
-        if (!(addr & (block_size - 1)) && goal - addr >= block_size) {
+        if (!(addr & (block_size - 1)) && goal - addr >= block_size && flash_cmd_addr_ok(block_cmd, addr)) {
             flash_user_erase(addr, block_cmd);
             addr += block_size;
         } else {
@@ -346,25 +515,221 @@ void __noinline flash_range_erase(uint32_t addr, size_t count, uint32_t block_si
 // ----------------------------------------------------------------------------
 // Read
 
+#ifdef USE_FLASH_WORD_READS
+// Receive count bytes (a multiple of 4) following the rx_skip bytes of command/address already sent, switching the SSI
+// to 32-bit frames for the data so each FIFO access moves 4 bytes. We drive CS ourselves, so the flash doesn't see the
+// SSI being reconfigured in between. Frames are shifted in MSB first, so the first byte is in the top of each word.
+static void __noinline flash_get_words(uint8_t *rx, size_t count, size_t rx_skip) {
+    // The command/address bytes must be out before the SSI is disabled
+    while (rx_skip && !flash_was_aborted()) {
+        if (ssi->rxflr) {
+            (void) ssi->dr0;
+            --rx_skip;
+        }
+    }
+    uint32_t ctrlr0 = ssi->ctrlr0;
+    ssi->ssienr = 0;
+    ssi->ctrlr0 = ctrlr0 | (31 << SSI_CTRLR0_DFS_32_LSB); // 32 clocks per data frame
+    ssi->ssienr = 1;
+    // As flash_put_get, the FIFOs are 16 frames deep whatever the frame size
+    const uint max_in_flight = 16 - 2;
+    size_t tx_count = count / 4;
+    size_t rx_count = rx_skip ? 0 : count / 4;
+    while (rx_count) {
+        uint32_t tx_level = ssi_hw->txflr;
+        uint32_t rx_level = ssi_hw->rxflr;
+        bool did_something = false;
+        if (tx_count && tx_level + rx_level < max_in_flight) {
+            ssi->dr0 = 0;
+            --tx_count;
+            did_something = true;
+        }
+        if (rx_level) {
+            uint32_t word = ssi->dr0;
+            for (int shift = 24; shift >= 0; shift -= 8)
+                *rx++ = (uint8_t) (word >> shift);
+            --rx_count;
+            did_something = true;
+        }
+        if (!did_something && __builtin_expect(flash_was_aborted(), 0))
+            break;
+    }
+    ssi->ssienr = 0;
+    ssi->ctrlr0 = ctrlr0;
+    ssi->ssienr = 1;
+    flash_cs_force(OUTOVER_HIGH);
+}
+#endif
+
 void __noinline flash_read_data(uint32_t addr, uint8_t *rx, size_t count) {
-    assert(addr < 0x1000000);
-    flash_put_cmd_addr(FLASHCMD_READ_DATA, addr);
-    flash_put_get(NULL, rx, count, 4);
+    assert(addr < 0x1000000 || flash_addr_is_4_byte(addr));
+    size_t skip = flash_put_cmd_addr(FLASHCMD_READ_DATA, addr);
+#ifdef USE_FLASH_WORD_READS
+    if (!(count & 3u)) {
+        flash_get_words(rx, count, skip);
+        return;
+    }
+#endif
+    flash_put_get(NULL, rx, count, skip);
+}
+
+#ifdef USE_FLASH_DMA
+// As flash_read_data, using flash_put_get_dma
+void flash_read_data_dma(uint32_t addr, uint8_t *rx, size_t count) {
+    assert(addr < 0x1000000 || flash_addr_is_4_byte(addr));
+    size_t skip = flash_put_cmd_addr(FLASHCMD_READ_DATA, addr);
+    flash_put_get_dma(NULL, rx, count, skip);
+}
+#endif
+
+#ifdef USE_FLASH_FAST_READ
+// Read with a command that has 8 dummy clocks between the address and the data (0Bh fast read, 5Ah SFDP read)
+static void __noinline flash_read_dummy_byte(uint8_t cmd, uint32_t addr, uint8_t *rx, size_t count) {
+    assert(addr < 0x1000000 || flash_addr_is_4_byte(addr));
+    size_t skip = flash_put_cmd_addr(cmd, addr) + 1;
+    ssi->dr0 = 0; // dummy byte
+    // (only the bootrom itself uses these)
+#if defined(USE_FLASH_DMA)
+    flash_put_get_dma(NULL, rx, count, skip);
+#else
+#ifdef USE_FLASH_WORD_READS
+    if (!(count & 3u)) {
+        flash_get_words(rx, count, skip);
+        return;
+    }
+#endif
+    flash_put_get(NULL, rx, count, skip);
+#endif
+}
+
+// As flash_read_data, but with 0Bh, which unlike 03h is usually specified up to the flash's full SPI clock
+void flash_read_data_fast(uint32_t addr, uint8_t *rx, size_t count) {
+    flash_read_dummy_byte(FLASHCMD_FAST_READ, addr, rx, count);
+}
+#endif
+
+// ----------------------------------------------------------------------------
+// Quad SPI (1-1-4) program and read
+//
+// The command and address are sent serially, and only the data uses all four IOs. In quad mode the SSI is
+// either transmitting or receiving, and a transfer ends as soon as the TX FIFO runs dry or NDF frames have been
+// received, so unlike flash_put_get these can't just pause when interrupted. Both use 32-bit data frames (the
+// SSI shifts these out MSB first, so they are byte swapped relative to memory)
+
+// Switch the SSI to quad frames for a single transfer to or from addr, saving the CTRLR0 and SPI_CTRLR0 values to
+// restore afterwards in saved
+static void __noinline flash_ssi_begin_quad(uint32_t tmod, uint32_t ndf, uint32_t wait_cycles, uint32_t addr,
+                                            uint32_t saved[2]) {
+    saved[0] = ssi->ctrlr0;
+    saved[1] = ssi->spi_ctrlr0;
+    ssi->ssienr = 0;
+    ssi->ctrlr0 =
+            (SSI_CTRLR0_SPI_FRF_VALUE_QUAD << SSI_CTRLR0_SPI_FRF_LSB) | // Quad data
+            (31 << SSI_CTRLR0_DFS_32_LSB) |                             // 32 clocks per data frame
+            (tmod << SSI_CTRLR0_TMOD_LSB);
+    ssi->ctrlr1 = ndf - 1;
+    ssi->spi_ctrlr0 =
+            (wait_cycles << SSI_SPI_CTRLR0_WAIT_CYCLES_LSB) |
+            (2u << SSI_SPI_CTRLR0_INST_L_LSB) |    // 8-bit instruction
+            ((flash_addr_is_4_byte(addr) ? 8u : 6u) << SSI_SPI_CTRLR0_ADDR_L_LSB) | // 32 or 24-bit addressing
+            (SSI_SPI_CTRLR0_TRANS_TYPE_VALUE_1C1A  // Command and address both in serial format
+                    << SSI_SPI_CTRLR0_TRANS_TYPE_LSB);
+    ssi->ssienr = 1;
+}
+
+static void __noinline flash_ssi_end_quad(const uint32_t saved[2]) {
+    // Wait for the transfer to finish before releasing CS
+    while ((ssi->sr & (SSI_SR_TFE_BITS | SSI_SR_BUSY_BITS)) != SSI_SR_TFE_BITS);
+    flash_cs_force(OUTOVER_HIGH);
+    ssi->ssienr = 0;
+    ssi->ctrlr0 = saved[0];
+    ssi->spi_ctrlr0 = saved[1];
+    // NDF back to its reset value, which everything else (including XIP) expects
+    ssi->ctrlr1 = 0;
+    ssi->ssienr = 1;
+}
+
+// Program a 256 byte page with the 32h quad page program command. The flash's QE bit must be set.
+// IRQs are disabled for the data phase (about 70us at the default baud rate), since the transfer would
+// end if the TX FIFO ran dry.
+void __noinline flash_page_program_quad(uint32_t addr, const uint8_t *data) {
+    assert(addr < 0x1000000 || flash_addr_is_4_byte(addr));
+    assert(!(addr & 0xffu));
+    flash_enable_write();
+    uint32_t save = save_and_disable_interrupts();
+    uint32_t saved[2];
+    flash_ssi_begin_quad(SSI_CTRLR0_TMOD_VALUE_TX_ONLY, 1, 0, addr, saved);
+    flash_cs_force(OUTOVER_LOW);
+#ifdef USE_FLASH_4_BYTE_ADDR
+    ssi->dr0 = flash_addr_is_4_byte(addr) ? flash_cmd_4_byte_addr(FLASHCMD_QUAD_PAGE_PROGRAM) :
+               FLASHCMD_QUAD_PAGE_PROGRAM;
+#else
+    ssi->dr0 = FLASHCMD_QUAD_PAGE_PROGRAM;
+#endif
+    ssi->dr0 = addr;
+    for (int i = 0; i < 256; i += 4) {
+        while (!(ssi->sr & SSI_SR_TFNF_BITS));
+        ssi->dr0 = __builtin_bswap32(bytes_to_u32le(data + i));
+    }
+    flash_ssi_end_quad(saved);
+    restore_interrupts(save);
+    flash_wait_ready();
+}
+
+// Read count bytes (a multiple of 4) with a 1-1-4 read command (e.g. 6Bh) needing the given number of dummy clocks.
+// To avoid RX FIFO overflow if we are interrupted, this is done as a series of short reads of no more than a FIFO's
+// worth each. Beyond the first 16MB, a command with no 4-byte address version falls back to 03h reads.
+void __noinline flash_read_data_quad(uint32_t addr, uint8_t *rx, size_t count, uint8_t cmd, uint8_t dummy_clocks) {
+    assert(addr < 0x1000000 || flash_addr_is_4_byte(addr));
+    assert(!(count & 3u));
+    const uint max_frames = 16 - 2; // account for data internal to SSI
+    while (count) {
+        if (!flash_cmd_addr_ok(cmd, addr)) {
+            flash_read_data(addr, rx, count);
+            return;
+        }
+        uint frames = count / 4 < max_frames ? count / 4 : max_frames;
+        uint32_t saved[2];
+        flash_ssi_begin_quad(SSI_CTRLR0_TMOD_VALUE_RX_ONLY, frames, dummy_clocks, addr, saved);
+        flash_cs_force(OUTOVER_LOW);
+#ifdef USE_FLASH_4_BYTE_ADDR
+        ssi->dr0 = flash_addr_is_4_byte(addr) ? flash_cmd_4_byte_addr(cmd) : cmd;
+#else
+        ssi->dr0 = cmd;
+#endif
+        ssi->dr0 = addr;
+        for (uint i = 0; i < frames; i++) {
+            while (!(ssi->sr & SSI_SR_RFNE_BITS));
+            uint32_t word = __builtin_bswap32(ssi->dr0);
+            for (int b = 0; b < 4; b++) {
+                *rx++ = (uint8_t) word;
+                word >>= 8;
+            }
+        }
+        flash_ssi_end_quad(saved);
+        addr += frames * 4;
+        count -= frames * 4;
+    }
 }
 
 // ----------------------------------------------------------------------------
 // Size determination via SFDP or JEDEC ID (best effort)
 // Relevant XKCD is 927
 
+#if defined(USE_FLASH_GEOMETRY) || defined(USE_FLASH_BAUD_CALIBRATION)
+// (the geometry and clock divider calibration read SFDP too)
+void flash_read_sfdp(uint32_t addr, uint8_t *rx, size_t count) {
+#else
 static inline void flash_read_sfdp(uint32_t addr, uint8_t *rx, size_t count) {
+#endif
+#ifdef USE_FLASH_FAST_READ
+    flash_read_dummy_byte(FLASHCMD_READ_SFDP, addr, rx, count);
+#else
     assert(addr < 0x1000000);
     flash_put_cmd_addr(FLASHCMD_READ_SFDP, addr);
     ssi->dr0 = 0; // dummy byte
     flash_put_get(NULL, rx, count, 5);
-}
-
-static inline __attribute__((always_inline)) uint32_t bytes_to_u32le(const uint8_t *b) {
-    return b[0] | (b[1] << 8) | (b[2] << 16) | (b[3] << 24);
+#endif
 }
 
 // Return value >= 0: log 2 of flash size in bytes.
@@ -372,6 +737,12 @@ static inline __attribute__((always_inline)) uint32_t bytes_to_u32le(const uint8
 int __noinline flash_size_log2() {
     uint8_t rxbuf[16];
 
+#ifdef USE_FLASH_GEOMETRY
+    uint len_words;
+    uint32_t param_table_ptr = flash_find_sfdp_bfpt(&len_words);
+    if (!param_table_ptr)
+        goto sfdp_fail;
+#else
     // Check magic
     flash_read_sfdp(0, rxbuf, 16);
     if (bytes_to_u32le(rxbuf) != ('S' | ('F' << 8) | ('D' << 16) | ('P' << 24)))
@@ -384,6 +755,7 @@ int __noinline flash_size_log2() {
         goto sfdp_fail;
 
     uint32_t param_table_ptr = bytes_to_u32le(rxbuf + 12) & 0xffffffu;
+#endif
     flash_read_sfdp(param_table_ptr, rxbuf, 8);
     uint32_t array_size_word = bytes_to_u32le(rxbuf + 4);
     // MSB set: array >= 2 Gbit, encoded as log2 of number of bits
@@ -416,6 +788,40 @@ int __noinline flash_size_log2() {
     return -1;
 }
 
+// Set the QE bit in the way described by the SFDP quad enable requirements, if it isn't already. Note this is normally
+// a non-volatile status register write, so we avoid rewriting it.
+// Return value true: quad commands may be used
+bool __noinline flash_enable_quad(uint qer) {
+    uint8_t sr[2];
+    if (qer == FLASH_QER_SR2_BIT7 || qer > FLASH_QER_SR2_BIT1_31H)
+        return false;
+    if (qer == FLASH_QER_NONE)
+        return true;
+    flash_do_cmd(FLASHCMD_READ_STATUS, NULL, sr, 1);
+    if (qer == FLASH_QER_SR1_BIT6) {
+        if (sr[0] & 0x40u)
+            return true;
+        sr[0] |= 0x40u;
+        flash_enable_write();
+        flash_do_cmd(FLASHCMD_WRITE_STATUS, sr, NULL, 1);
+    } else {
+        flash_do_cmd(FLASHCMD_READ_STATUS2, NULL, sr + 1, 1);
+        if (sr[1] & 0x02u)
+            return true;
+        sr[1] |= 0x02u;
+        flash_enable_write();
+        if (qer == FLASH_QER_SR2_BIT1_31H) {
+            flash_do_cmd(FLASHCMD_WRITE_STATUS2, sr + 1, NULL, 1);
+        } else {
+            // Write both status registers together (writing just one may clear the other)
+            flash_do_cmd(FLASHCMD_WRITE_STATUS, sr, NULL, 2);
+        }
+    }
+    flash_wait_ready();
+    flash_do_cmd(qer == FLASH_QER_SR1_BIT6 ? FLASHCMD_READ_STATUS : FLASHCMD_READ_STATUS2, NULL, sr, 1);
+    return sr[0] & (qer == FLASH_QER_SR1_BIT6 ? 0x40u : 0x02u);
+}
+
 // ----------------------------------------------------------------------------
 // XIP Entry
 
@@ -432,6 +838,37 @@ void __noinline flash_flush_cache() {
     flash_cs_force(OUTOVER_NORMAL);
 }
 
+#ifdef USE_FLASH_FAST_READ
+// Put the SSI into a mode where XIP accesses translate to the given standard serial read command, with wait_cycles
+// dummy clocks between the address and the data.
+static void __noinline flash_enter_cmd_xip_with(uint8_t cmd, uint32_t wait_cycles) {
+    ssi->ssienr = 0;
+    ssi->ctrlr0 =
+            (SSI_CTRLR0_SPI_FRF_VALUE_STD << SSI_CTRLR0_SPI_FRF_LSB) |  // Standard 1-bit SPI serial frames
+            (31 << SSI_CTRLR0_DFS_32_LSB) |                             // 32 clocks per data frame
+            (SSI_CTRLR0_TMOD_VALUE_EEPROM_READ << SSI_CTRLR0_TMOD_LSB); // Send instr + addr, receive data
+    ssi->spi_ctrlr0 =
+            (cmd << SSI_SPI_CTRLR0_XIP_CMD_LSB) |
+            (wait_cycles << SSI_SPI_CTRLR0_WAIT_CYCLES_LSB) |
+            (2u << SSI_SPI_CTRLR0_INST_L_LSB) |    // 8-bit instruction prefix
+            (6u << SSI_SPI_CTRLR0_ADDR_L_LSB) |    // 24-bit addressing for 03h/0Bh commands
+            (SSI_SPI_CTRLR0_TRANS_TYPE_VALUE_1C1A  // Command and address both in serial format
+                    << SSI_SPI_CTRLR0_TRANS_TYPE_LSB);
+    ssi->ssienr = 1;
+}
+
+// Put the SSI into a mode where XIP accesses translate to standard
+// serial 03h read commands. The flash remains in its default serial command
+// state, so will still respond to other commands.
+void __noinline flash_enter_cmd_xip() {
+    flash_enter_cmd_xip_with(FLASHCMD_READ_DATA, 0);
+}
+
+// As flash_enter_cmd_xip, but with 0Bh fast reads (8 dummy clocks)
+void flash_enter_cmd_xip_fast() {
+    flash_enter_cmd_xip_with(FLASHCMD_FAST_READ, 8);
+}
+#else
 // Put the SSI into a mode where XIP accesses translate to standard
 // serial 03h read commands. The flash remains in its default serial command
 // state, so will still respond to other commands.
@@ -449,3 +886,4 @@ void __noinline flash_enter_cmd_xip() {
                     << SSI_SPI_CTRLR0_TRANS_TYPE_LSB);
     ssi->ssienr = 1;
 }
+#endif
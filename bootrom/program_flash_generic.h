@@ -9,9 +9,38 @@
 
 #include <stdint.h>
 #include <stddef.h>
+#include <stdbool.h>
+#include "pico/types.h"
+
+#if defined(USE_FLASH_ERASE_SUSPEND) && !defined(USE_FLASH_GEOMETRY)
+// erase suspend support comes from the flash geometry
+#define USE_FLASH_GEOMETRY
+#endif
+#if defined(USE_FLASH_QUAD) && !defined(USE_FLASH_GEOMETRY)
+// whether to use quad commands comes from the flash geometry
+#define USE_FLASH_GEOMETRY
+#endif
+
+// SSI clock divider set by flash_init_spi()
+#define FLASH_BAUD_DIV_DEFAULT 6u
+// the smallest divider the SSI supports
+#define FLASH_BAUD_DIV_MIN 2u
+
+// USE_FLASH_4_BYTE_ADDR: program, erase and read addresses beyond the first 16MB use the flash's 4-byte address
+// commands (12h, 13h, 0Ch, 21h/5Ch/DCh, 34h, 6Ch). Without it, only the first 16MB can be addressed
+
+#ifdef USE_FLASH_4_BYTE_ADDR
+// whether the address-taking command cmd can be sent for addr: either addr is within the first 16MB, or cmd has a
+// 4-byte address version we know of
+bool flash_cmd_addr_ok(uint8_t cmd, uint32_t addr);
+#else
+// (addresses can only be within the first 16MB)
+#define flash_cmd_addr_ok(cmd, addr) true
+#endif
 
 void connect_internal_flash();
 void flash_init_spi();
+void flash_set_baud_div(uint div);
 void flash_put_get(const uint8_t *tx, uint8_t *rx, size_t count, size_t rx_skip);
 void flash_do_cmd(uint8_t cmd, const uint8_t *tx, uint8_t *rx, size_t count);
 void flash_exit_xip();
@@ -19,6 +48,8 @@ void flash_page_program(uint32_t addr, const uint8_t *data);
 void flash_range_program(uint32_t addr, const uint8_t *data, size_t count);
 void flash_sector_erase(uint32_t addr);
 void flash_user_erase(uint32_t addr, uint8_t cmd);
+void flash_user_erase_start(uint32_t addr, uint8_t cmd);
+bool flash_busy();
 void flash_range_erase(uint32_t addr, size_t count, uint32_t block_size, uint8_t block_cmd);
 void flash_read_data(uint32_t addr, uint8_t *rx, size_t count);
 int flash_size_log2();
@@ -27,4 +58,79 @@ void flash_enter_cmd_xip();
 void flash_abort();
 int flash_was_aborted();
 
+#if defined(USE_FLASH_GEOMETRY) || defined(USE_FLASH_BAUD_CALIBRATION)
+void flash_read_sfdp(uint32_t addr, uint8_t *rx, size_t count);
+#endif
+
+#ifdef USE_FLASH_DMA
+// DMA channels used by flash_put_get_dma
+#ifndef FLASH_DMA_CHANNEL_TX
+#define FLASH_DMA_CHANNEL_TX 0
+#endif
+#ifndef FLASH_DMA_CHANNEL_RX
+#define FLASH_DMA_CHANNEL_RX 1
+#endif
+
+// DMA driven variants of flash_put_get, flash_page_program and flash_read_data. With USE_FLASH_DMA, the fast reads below
+// (and SFDP reads, which then share their code) use flash_put_get_dma too
+void flash_put_get_dma(const uint8_t *tx, uint8_t *rx, size_t count, size_t rx_skip);
+void flash_page_program_dma(uint32_t addr, const uint8_t *data);
+void flash_read_data_dma(uint32_t addr, uint8_t *rx, size_t count);
+#endif
+
+#ifdef USE_FLASH_FAST_READ
+// 0Bh fast read variants of flash_read_data and flash_enter_cmd_xip
+void flash_read_data_fast(uint32_t addr, uint8_t *rx, size_t count);
+void flash_enter_cmd_xip_fast();
+#endif
+
+// Quad SPI (1-1-4) page program and read, for flash whose geometry (see below) reports quad support
+bool flash_enable_quad(uint qer);
+void flash_page_program_quad(uint32_t addr, const uint8_t *data);
+void flash_read_data_quad(uint32_t addr, uint8_t *rx, size_t count, uint8_t cmd, uint8_t dummy_clocks);
+
+// ----------------------------------------------------------------------------
+// Flash geometry, from the SFDP basic flash parameter table (flash_geometry.c)
+
+// SFDP quad enable requirements (those not listed, 1, 4 and 5, all have QE in bit 1 of status register 2, which
+// is written along with status register 1 by 01h)
+#define FLASH_QER_NONE 0u
+#define FLASH_QER_SR1_BIT6 2u
+#define FLASH_QER_SR2_BIT7 3u // not supported
+#define FLASH_QER_SR2_BIT1_31H 6u
+#define FLASH_QER_UNKNOWN 0xffu
+
+// address modes
+#define FLASH_ADDR_3_BYTE 1u
+#define FLASH_ADDR_4_BYTE 2u
+
+#define FLASH_ERASE_TYPES 4
+
+struct flash_geometry {
+    uint8_t size_log2; // in bytes; 0 if unknown
+    uint8_t page_size_log2;
+    uint8_t addr_modes; // FLASH_ADDR_ bits
+    uint8_t qer; // SFDP quad enable requirements, or FLASH_QER_UNKNOWN
+    // in ascending order of size; unused entries have a size_log2 of 0
+    struct flash_erase_type {
+        uint8_t size_log2;
+        uint8_t cmd;
+        uint16_t typ_ms; // typical erase time, 0 if unknown
+    } erase_types[FLASH_ERASE_TYPES];
+    uint16_t page_program_typ_us; // 0 if unknown
+    // 1-1-4 and 1-4-4 fast reads; cmd is 0 if not supported. dummy_clocks includes any mode clocks
+    uint8_t quad_out_read_cmd;
+    uint8_t quad_out_read_dummy_clocks;
+    uint8_t quad_io_read_cmd;
+    uint8_t quad_io_read_dummy_clocks;
+    bool sfdp; // false if the flash has no (usable) SFDP, in which case the above are defaults
+    // erase suspend and resume commands; 0 if not supported
+    uint8_t erase_suspend_cmd;
+    uint8_t erase_resume_cmd;
+    uint8_t _pad[2];
+};
+
+uint32_t flash_find_sfdp_bfpt(uint *len_words);
+bool flash_read_geometry(struct flash_geometry *geometry);
+
 #endif // _PROGRAM_FLASH_GENERIC_H_
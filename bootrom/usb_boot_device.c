@@ -181,6 +181,22 @@ static const struct usb_transfer_type _picoboot_cmd_transfer_type = {
 
 struct picoboot_cmd_status _picoboot_current_cmd_status;
 
+static struct picoboot_stream_transfer {
+    struct usb_stream_transfer stream;
+    struct async_task task;
+#if ASYNC_TASK_QUEUE_DEPTH > 1
+    // number of chunk tasks queued for the current command which have not yet completed
+    uint8_t in_flight;
+    // when on_stream_chunk returned async, the in_flight count at or below which we call usb_stream_chunk_done;
+    // -1 if we are not waiting
+    int8_t wait_in_flight;
+    uint8_t buffer_index;
+#endif
+} _picoboot_stream_transfer;
+
+// one chunk buffer per queue slot, so the host can keep sending while earlier chunks are written
+static uint8_t _picoboot_buffers[ASYNC_TASK_QUEUE_DEPTH][FLASH_PAGE_SIZE];
+
 static void _picoboot_reset() {
     usb_debug("PICOBOOT RESET\n");
     usb_soft_reset_endpoint(&picoboot_out);
@@ -190,6 +206,10 @@ static void _picoboot_reset() {
         flash_abort();
     }
     memset0(&_picoboot_current_cmd_status, sizeof(_picoboot_current_cmd_status));
+#if ASYNC_TASK_QUEUE_DEPTH > 1
+    _picoboot_stream_transfer.in_flight = 0;
+    _picoboot_stream_transfer.wait_in_flight = -1;
+#endif
     // reset queue (note this also clears exclusive access)
     reset_queue(&virtual_disk_queue);
     reset_queue(&picoboot_queue);
@@ -212,6 +232,16 @@ static void _picoboot_ack() {
 
 #define _tf_ack ((usb_transfer_completed_func)_picoboot_ack)
 
+#ifdef USE_TASK_STATS
+// vendor IN request returning the struct async_task_stats selected by wValue
+#define PICOBOOT_IF_TASK_STATS 0x43
+#endif
+
+#ifdef USE_FLASH_VERIFY
+// vendor IN request returning the struct flash_verify_status
+#define PICOBOOT_IF_FLASH_VERIFY 0x44
+#endif
+
 static bool _picoboot_setup_request_handler(__unused struct usb_interface *interface, struct usb_setup_packet *setup) {
     setup = __builtin_assume_aligned(setup, 4);
     if (USB_REQ_TYPE_TYPE_VENDOR == (setup->bmRequestType & USB_REQ_TYPE_TYPE_MASK)) {
@@ -223,6 +253,40 @@ static bool _picoboot_setup_request_handler(__unused struct usb_interface *inter
                 usb_start_single_buffer_control_in_transfer();
                 return true;
             }
+#ifdef USE_PICOBOOT_RESUME
+            // a longer status request also returns the struct async_task_progress for the last command, so that
+            // after a reset the host can resume a write or erase from the first address not yet committed
+            if (setup->bRequest == PICOBOOT_IF_CMD_STATUS &&
+                setup->wLength == sizeof(_picoboot_current_cmd_status) + sizeof(struct async_task_progress)) {
+                uint8_t *buffer = usb_get_single_packet_response_buffer(usb_get_control_in_endpoint(),
+                                                                        setup->wLength);
+                memcpy(buffer, &_picoboot_current_cmd_status, sizeof(_picoboot_current_cmd_status));
+                memcpy(buffer + sizeof(_picoboot_current_cmd_status), &async_task_progress,
+                       sizeof(struct async_task_progress));
+                usb_start_single_buffer_control_in_transfer();
+                return true;
+            }
+#endif
+#ifdef USE_TASK_STATS
+            if (setup->bRequest == PICOBOOT_IF_TASK_STATS && setup->wValue < ASYNC_TASK_STATS_COUNT &&
+                setup->wLength == sizeof(struct async_task_stats)) {
+                // note the worker may be part way through updating this entry, which we accept for diagnostics
+                uint8_t *buffer = usb_get_single_packet_response_buffer(usb_get_control_in_endpoint(),
+                                                                        sizeof(struct async_task_stats));
+                memcpy(buffer, &async_task_stats[setup->wValue], sizeof(struct async_task_stats));
+                usb_start_single_buffer_control_in_transfer();
+                return true;
+            }
+#endif
+#ifdef USE_FLASH_VERIFY
+            if (setup->bRequest == PICOBOOT_IF_FLASH_VERIFY && setup->wLength == sizeof(struct flash_verify_status)) {
+                uint8_t *buffer = usb_get_single_packet_response_buffer(usb_get_control_in_endpoint(),
+                                                                        sizeof(struct flash_verify_status));
+                memcpy(buffer, &flash_verify_status, sizeof(struct flash_verify_status));
+                usb_start_single_buffer_control_in_transfer();
+                return true;
+            }
+#endif
         } else {
             if (setup->bRequest == PICOBOOT_IF_RESET) {
                 _picoboot_reset();
@@ -234,11 +298,6 @@ static bool _picoboot_setup_request_handler(__unused struct usb_interface *inter
     return false;
 }
 
-static struct picoboot_stream_transfer {
-    struct usb_stream_transfer stream;
-    struct async_task task;
-} _picoboot_stream_transfer;
-
 static void _atc_ack(struct async_task *task) {
     if (task->picoboot_user_token == _picoboot_stream_transfer.task.picoboot_user_token) {
         usb_warn("atc_ack\n");
@@ -254,15 +313,23 @@ static void _set_cmd_status(uint32_t status) {
 }
 
 static void _atc_chunk_task_done(struct async_task *task) {
-    if (task->picoboot_user_token == _picoboot_stream_transfer.task.picoboot_user_token) {
-        // save away result
-        _set_cmd_status(task->result);
+    if (task->token == _picoboot_stream_transfer.task.token) {
+        // save away result (keeping the first failure if multiple chunks were in flight)
+        if (!_picoboot_current_cmd_status.dStatusCode) {
+            _set_cmd_status(task->result);
+        }
         if (task->result) {
             usb_halt_endpoint(_picoboot_stream_transfer.stream.ep);
             _picoboot_current_cmd_status.bInProgress = false;
         }
-        // we update the position of the original task which will be submitted again in on_stream_chunk
-        _picoboot_stream_transfer.task.transfer_addr += task->data_length;
+#if ASYNC_TASK_QUEUE_DEPTH > 1
+        _picoboot_stream_transfer.in_flight--;
+        if (_picoboot_stream_transfer.in_flight > _picoboot_stream_transfer.wait_in_flight) {
+            // stream is still running, or we are waiting for more chunks to complete
+            return;
+        }
+        _picoboot_stream_transfer.wait_in_flight = -1;
+#endif
         usb_stream_chunk_done(&_picoboot_stream_transfer.stream);
     }
 }
@@ -275,6 +342,24 @@ __rom_function_static_impl(bool, _picoboot_on_stream_chunk)(uint32_t chunk_len _
     queue_task(&picoboot_queue, &_picoboot_stream_transfer.task, _atc_chunk_task_done);
     // for subsequent tasks, check the mutation source
     _picoboot_stream_transfer.task.check_last_mutation_source = true;
+    // we update the position of the original task which will be submitted again in on_stream_chunk
+    _picoboot_stream_transfer.task.transfer_addr += chunk_len;
+#if ASYNC_TASK_QUEUE_DEPTH > 1
+    uint in_flight = ++_picoboot_stream_transfer.in_flight;
+    bool last = true;
+    if (_picoboot_stream_transfer.task.type & AT_WRITE) {
+        last = usb_stream_out_chunk_is_last(&_picoboot_stream_transfer.stream);
+        // move on to the next buffer; if that is still in flight we hold off the host below until it has completed
+        uint8_t *next = _picoboot_buffers[++_picoboot_stream_transfer.buffer_index & (ASYNC_TASK_QUEUE_DEPTH - 1u)];
+        _picoboot_stream_transfer.stream.chunk_buffer = _picoboot_stream_transfer.task.data = next;
+    }
+    if (!last && in_flight < ASYNC_TASK_QUEUE_DEPTH) {
+        // keep accepting data from the host while the worker writes this chunk
+        return false;
+    }
+    // hold off the host until a buffer is free, or for the last chunk until everything has been written
+    _picoboot_stream_transfer.wait_in_flight = last ? 0 : ASYNC_TASK_QUEUE_DEPTH - 1;
+#endif
     return true;
 }
 
@@ -342,15 +427,20 @@ static void _picoboot_cmd_packet_internal(struct usb_endpoint *ep) {
                     _picoboot_stream_transfer.task.source = TASK_SOURCE_PICOBOOT;
                     _picoboot_current_cmd_status.bInProgress = true;
                     if (cmd->dTransferLength) {
-                        static uint8_t _buffer[FLASH_PAGE_SIZE];
                         static const struct usb_stream_transfer_funcs _picoboot_stream_funcs = {
                                 .on_packet_complete = usb_stream_noop_on_packet_complete,
                                 .on_chunk = __rom_function_ref(_picoboot_on_stream_chunk)
                         };
 
-                        _picoboot_stream_transfer.task.data = _buffer;
+                        uint8_t *buffer = _picoboot_buffers[0];
+#if ASYNC_TASK_QUEUE_DEPTH > 1
+                        _picoboot_stream_transfer.in_flight = 0;
+                        _picoboot_stream_transfer.wait_in_flight = -1;
+                        _picoboot_stream_transfer.buffer_index = 0;
+#endif
+                        _picoboot_stream_transfer.task.data = buffer;
                         usb_stream_setup_transfer(&_picoboot_stream_transfer.stream,
-                                                  &_picoboot_stream_funcs, _buffer, FLASH_PAGE_SIZE,
+                                                  &_picoboot_stream_funcs, buffer, FLASH_PAGE_SIZE,
                                                   cmd->dTransferLength,
                                                   _tf_ack);
                         if (type & AT_WRITE) {
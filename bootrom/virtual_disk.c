@@ -142,11 +142,34 @@ struct dir_entry {
 
 static_assert(sizeof(struct dir_entry) == 32, "");
 
+#if defined(USE_UF2_ERASE_AHEAD) || defined(USE_FLASH_BLOCK_ERASE)
+#define UF2_TRACK_LINEAR
+#endif
+
+#if defined(USE_UF2_BLOCK_INTERVALS) && !defined(UF2_BLOCK_INTERVALS)
+#define UF2_BLOCK_INTERVALS 4
+#endif
+
+// a set of UF2 block (or flash sector) numbers, for which bitmap holds max bits
+struct uf2_block_set {
+    uint32_t *bitmap;
+    uint32_t max;
+#ifdef USE_UF2_BLOCK_INTERVALS
+    // UF2 images are written in order (or nearly so), so the set is held as up to UF2_BLOCK_INTERVALS sorted, disjoint
+    // and non adjacent [start, end) intervals, normally just the one. Only if it gets more fragmented than that is the
+    // bitmap cleared and used instead, so starting a new transfer doesn't have to clear kilobytes of XIP SRAM
+    bool use_bitmap;
+    uint8_t interval_count;
+    struct {
+        uint32_t start;
+        uint32_t end;
+    } intervals[UF2_BLOCK_INTERVALS];
+#endif
+};
+
 static struct uf2_info {
-    uint32_t *valid_blocks;
-    uint32_t max_valid_blocks;
-    uint32_t *cleared_pages;
-    uint32_t max_cleared_pages;
+    struct uf2_block_set valid_blocks;
+    struct uf2_block_set cleared_pages;
     uint32_t num_blocks;
     uint32_t token;
     uint32_t valid_block_count;
@@ -154,8 +177,241 @@ static struct uf2_info {
     uint32_t block_no;
     struct async_task next_task;
     bool ram;
+#ifdef UF2_TRACK_LINEAR
+    // true while every block seen so far is at linear_base + block_no * FLASH_PAGE_SIZE (with linear_base sector aligned),
+    // in which case the cleared_pages index for a block is also the index of the flash sector it lands in
+    bool linear;
+    uint32_t linear_base;
+    // where the image ends if it is linear throughout, i.e. linear_base plus num_blocks payloads (within the flash)
+    uint32_t image_end;
+#endif
+#ifdef USE_UF2_PAGE_ASSEMBLY
+    // payload size of the first block seen, which the image is linear in if it is linear at all
+    uint32_t payload_size;
+#endif
 } _uf2_info;
 
+#if defined(USE_UF2_PAGE_ASSEMBLY) || defined(USE_UF2_BLOCK_INTERVALS)
+// UF2 payloads can be any size and alignment, and there can be any number of blocks, so cleared_pages is indexed by
+// flash sector
+#define UF2_CLEARED_BY_FLASH_SECTOR
+#define UF2_CLEARED_BASE XIP_MAIN_BASE
+#else
+// cleared_pages is indexed by sector of the image (for a linear image; see _write_uf2_page)
+#define UF2_CLEARED_BASE _uf2_info.linear_base
+#endif
+#ifdef USE_UF2_PAGE_ASSEMBLY
+#define UF2_PAYLOAD_SIZE _uf2_info.payload_size
+#else
+#define UF2_PAYLOAD_SIZE FLASH_PAGE_SIZE
+#endif
+// cleared_pages index of the sector holding addr
+#define UF2_PAGE_NO(addr) (((addr) - UF2_CLEARED_BASE) / FLASH_SECTOR_ERASE_SIZE)
+#ifdef UF2_TRACK_LINEAR
+// cleared_pages index of the last sector a linear image writes if it has no address gaps
+#define UF2_IMAGE_END_PAGE_NO() UF2_PAGE_NO(_uf2_info.image_end - 1u)
+
+// end of the flash, if we know its size, otherwise of the 16M XIP window
+static uint32_t _flash_end() {
+#ifdef USE_CURRENT_UF2
+    if (async_task_flash_size_log2) return XIP_MAIN_BASE + (1u << async_task_flash_size_log2);
+#endif
+    return XIP_MAIN_BASE + 0x1000000u;
+}
+#endif
+
+static void _clear_bitset(uint32_t *mask, uint32_t count) {
+    memset0(mask, count / 8);
+}
+
+static void _block_set_init(struct uf2_block_set *set, uint32_t *bitmap, uint32_t max) {
+    set->bitmap = bitmap;
+    set->max = max;
+#ifndef USE_UF2_BLOCK_INTERVALS
+    _clear_bitset(bitmap, max);
+#endif
+}
+
+static bool _block_set_contains(const struct uf2_block_set *set, uint32_t n) {
+#ifdef USE_UF2_BLOCK_INTERVALS
+    if (!set->use_bitmap) {
+        for (uint i = set->interval_count; i--;) {
+            if (n >= set->intervals[i].start) return n < set->intervals[i].end;
+        }
+        return false;
+    }
+    if (n >= set->max) return false;
+#endif
+    return set->bitmap[n / 32] & (1u << (n & 31u));
+}
+
+#ifdef USE_UF2_BLOCK_INTERVALS
+// index of the first interval starting after n
+static uint _block_set_find(const struct uf2_block_set *set, uint32_t n) {
+    uint i = set->interval_count;
+    while (i && set->intervals[i - 1].start > n) i--;
+    return i;
+}
+
+// make room for an interval at index i (return false if there is none)
+static bool _block_set_insert(struct uf2_block_set *set, uint i) {
+    if (set->interval_count == UF2_BLOCK_INTERVALS) return false;
+    for (uint j = set->interval_count++; j > i; j--) {
+        set->intervals[j] = set->intervals[j - 1];
+    }
+    return true;
+}
+
+static void _block_set_delete(struct uf2_block_set *set, uint i) {
+    while (++i < set->interval_count) {
+        set->intervals[i - 1] = set->intervals[i];
+    }
+    set->interval_count--;
+}
+
+// switch the set over to its bitmap; return false if it doesn't fit
+static bool _block_set_use_bitmap(struct uf2_block_set *set) {
+    uf2_debug("Block set %p too fragmented, using bitmap\n", set);
+    for (uint i = 0; i < set->interval_count; i++) {
+        if (set->intervals[i].end > set->max) return false;
+    }
+    _clear_bitset(set->bitmap, set->max);
+    for (uint i = 0; i < set->interval_count; i++) {
+        for (uint32_t n = set->intervals[i].start; n < set->intervals[i].end; n++) {
+            set->bitmap[n / 32] |= 1u << (n & 31u);
+        }
+    }
+    set->use_bitmap = true;
+    return true;
+}
+#endif
+
+// return false if the set can't hold n
+static bool _block_set_add(struct uf2_block_set *set, uint32_t n) {
+#ifdef USE_UF2_BLOCK_INTERVALS
+    if (!set->use_bitmap) {
+        uint i = _block_set_find(set, n);
+        bool join_prev = i && set->intervals[i - 1].end >= n;
+        bool join_next = i < set->interval_count && set->intervals[i].start == n + 1;
+        if (join_prev) {
+            if (set->intervals[i - 1].end == n) {
+                if (join_next) {
+                    set->intervals[i - 1].end = set->intervals[i].end;
+                    _block_set_delete(set, i);
+                } else {
+                    set->intervals[i - 1].end = n + 1;
+                }
+            }
+            return true;
+        }
+        if (join_next) {
+            set->intervals[i].start = n;
+            return true;
+        }
+        if (_block_set_insert(set, i)) {
+            set->intervals[i].start = n;
+            set->intervals[i].end = n + 1;
+            return true;
+        }
+        if (!_block_set_use_bitmap(set)) return false;
+    }
+    if (n >= set->max) return false;
+#else
+    assert(n < set->max);
+#endif
+    set->bitmap[n / 32] |= 1u << (n & 31u);
+    return true;
+}
+
+#ifdef USE_UF2_ERASE_AHEAD
+// return false if the set can't represent the result (in which case it is left as is)
+static bool _block_set_remove(struct uf2_block_set *set, uint32_t n) {
+#ifdef USE_UF2_BLOCK_INTERVALS
+    if (!set->use_bitmap) {
+        uint i = _block_set_find(set, n);
+        if (!i || n >= set->intervals[i - 1].end) return true;
+        i--;
+        if (n == set->intervals[i].start) {
+            if (++set->intervals[i].start == set->intervals[i].end) _block_set_delete(set, i);
+            return true;
+        }
+        if (n + 1 == set->intervals[i].end) {
+            set->intervals[i].end = n;
+            return true;
+        }
+        // split the interval around n
+        if (_block_set_insert(set, i + 1)) {
+            set->intervals[i + 1].start = n + 1;
+            set->intervals[i].end = n;
+            return true;
+        }
+        if (!_block_set_use_bitmap(set)) return false;
+    }
+    if (n >= set->max) return true;
+#endif
+    set->bitmap[n / 32] &= ~(1u << (n & 31u));
+    return true;
+}
+#endif
+
+// each MSC sector buffer may have a page write queued, so the queue must be able to hold them all
+static_assert(MSC_SECTOR_BUFFER_COUNT <= ASYNC_TASK_QUEUE_DEPTH, "");
+
+// set up the erase in task for the (not yet cleared) sector page_no at sector_addr, marking it in cleared_pages.
+// for a linear image this is widened to a 32K or 64K block if the image writes all of that block (as with erase ahead,
+// the block must lie within the extent num_blocks implies, so it may reach into a gap) and none of it is cleared yet
+#ifdef USE_FLASH_BLOCK_ERASE
+// the i'th largest block erase size (log2) bigger than a sector, or 0 if there are no more
+static uint _block_erase_size_log2(uint i) {
+#ifdef USE_FLASH_GEOMETRY
+    const struct flash_erase_type *et = async_task_flash_geometry.erase_types + FLASH_ERASE_TYPES;
+    // (until the worker has read the geometry, assume the standard 32K and 64K block erases)
+    if (async_task_flash_geometry.erase_types[0].size_log2) {
+        while (et-- > async_task_flash_geometry.erase_types) {
+            if (et->size_log2 > FLASH_SECTOR_ERASE_SIZE_LOG2 && et->size_log2 < 32 && !i--) return et->size_log2;
+        }
+        return 0;
+    }
+#endif
+    return i < 2 ? 16 - i : 0;
+}
+#endif
+
+static void _set_uf2_erase(struct async_task *task, uint page_no, uint32_t sector_addr) {
+    uint count = 1;
+#ifdef USE_FLASH_BLOCK_ERASE
+    if (_uf2_info.linear) {
+        uint end_page_no = UF2_IMAGE_END_PAGE_NO();
+        uint block_size_log2;
+        for (uint j = 0; (block_size_log2 = _block_erase_size_log2(j)); j++) {
+            uint32_t block_size = 1u << block_size_log2;
+            uint32_t block_addr = sector_addr & ~(block_size - 1);
+            if (block_addr < _uf2_info.linear_base) continue;
+            uint first = UF2_PAGE_NO(block_addr);
+            uint n = block_size / FLASH_SECTOR_ERASE_SIZE;
+            if (first + n - 1 > end_page_no) continue;
+            uint i;
+            for (i = 0; i < n && !_block_set_contains(&_uf2_info.cleared_pages, first + i); i++);
+            if (i == n) {
+                page_no = first;
+                sector_addr = block_addr;
+                count = n;
+                break;
+            }
+        }
+    }
+#endif
+    task->erase_addr = sector_addr;
+    task->erase_size = count * FLASH_SECTOR_ERASE_SIZE;
+    task->type |= AT_FLASH_ERASE;
+    usb_debug("Setting erase addr %08x+%08x\n", (uint) task->erase_addr, (uint) task->erase_size);
+    do {
+        // (cleared_pages always has room for every sector the image can write)
+        __unused bool ok = _block_set_add(&_uf2_info.cleared_pages, page_no++);
+        assert(ok);
+    } while (--count);
+}
+
 // --- start non IRQ code ---
 
 static void _write_uf2_page_complete(struct async_task *task) {
@@ -163,6 +419,12 @@ static void _write_uf2_page_complete(struct async_task *task) {
         if (!task->result && _uf2_info.valid_block_count == _uf2_info.num_blocks) {
             safe_reboot(_uf2_info.ram ? _uf2_info.lowest_addr : 0, SRAM_END, 1000); //300); // reboot in 300 ms
         }
+#ifdef USE_FLASH_VERIFY
+        if (task->result) {
+            // the block isn't in flash after all; rather than reboot into a bad image, the whole UF2 must be sent again
+            _uf2_info.num_blocks = 0;
+        }
+#endif
     }
     vd_async_complete(task->token, task->result);
 }
@@ -189,9 +451,12 @@ static bool _write_uf2_page() {
     // along with erase etc.
     usb_debug("_write_uf2_page tok %d block %d / %d\n", (int) _uf2_info.token, _uf2_info.block_no,
               (int) _uf2_info.info.num_blocks);
-    uint block_offset = _uf2_info.block_no / 32;
-    uint32_t block_mask = 1u << (_uf2_info.block_no & 31u);
-    if (!(_uf2_info.valid_blocks[block_offset] & block_mask)) {
+    if (!_block_set_contains(&_uf2_info.valid_blocks, _uf2_info.block_no)) {
+        if (!_block_set_add(&_uf2_info.valid_blocks, _uf2_info.block_no)) {
+            uf2_debug("Oops image requires too many blocks to track\n");
+            _uf2_info.num_blocks = 0; // invalid
+            return false;
+        }
         // note we don't want to pick XIP_CACHE over RAM even though it has a lower address
         bool xip_cache_next = _uf2_info.next_task.transfer_addr < SRAM_BASE;
         bool xip_cache_lowest = _uf2_info.lowest_addr < SRAM_BASE;
@@ -202,26 +467,49 @@ static bool _write_uf2_page() {
         if (_uf2_info.ram) {
             assert(_uf2_info.next_task.transfer_addr);
         } else {
+            assert(_uf2_info.cleared_pages.bitmap);
+#ifdef USE_UF2_PAGE_ASSEMBLY
+            // the block may straddle two sectors (it can't be more, as a payload is less than a sector)
+            struct async_task *task = &_uf2_info.next_task;
+            uint32_t sector_addr = task->transfer_addr & ~(FLASH_SECTOR_ERASE_SIZE - 1u);
+            do {
+                uint page_no = UF2_PAGE_NO(sector_addr);
+                if (!_block_set_contains(&_uf2_info.cleared_pages, page_no)) {
+                    if (task->type & AT_FLASH_ERASE) {
+                        // (the erase for the first sector didn't reach this one, so must end right before it)
+                        assert(task->erase_addr + task->erase_size == sector_addr);
+                        task->erase_size += FLASH_SECTOR_ERASE_SIZE;
+                        __unused bool ok = _block_set_add(&_uf2_info.cleared_pages, page_no);
+                        assert(ok);
+                    } else {
+                        _set_uf2_erase(task, page_no, sector_addr);
+                    }
+                }
+                sector_addr += FLASH_SECTOR_ERASE_SIZE;
+            } while (sector_addr < task->transfer_addr + task->data_length);
+#else
+#ifdef UF2_CLEARED_BY_FLASH_SECTOR
+            uint page_no = UF2_PAGE_NO(_uf2_info.next_task.transfer_addr);
+#else
             uint page_no = _uf2_info.block_no * 256 / FLASH_SECTOR_ERASE_SIZE;
-            assert(_uf2_info.cleared_pages);
-            assert(page_no < _uf2_info.max_cleared_pages);
-            uint page_offset = page_no / 32;
-            uint32_t page_mask = 1u << (page_no & 31u);
-            assert(page_offset <= _uf2_info.max_cleared_pages);
-            if (!(_uf2_info.cleared_pages[page_offset] & page_mask)) {
-                _uf2_info.next_task.erase_addr = _uf2_info.next_task.transfer_addr & ~(FLASH_SECTOR_ERASE_SIZE - 1u);
-                _uf2_info.next_task.erase_size = FLASH_SECTOR_ERASE_SIZE; // always erase a single sector
-                usb_debug("Setting erase addr %08x\n", (uint) _uf2_info.next_task.erase_addr);
-                _uf2_info.cleared_pages[page_offset] |= page_mask;
-                _uf2_info.next_task.type |= AT_FLASH_ERASE;
+#endif
+            if (!_block_set_contains(&_uf2_info.cleared_pages, page_no)) {
+                _set_uf2_erase(&_uf2_info.next_task, page_no,
+                               _uf2_info.next_task.transfer_addr & ~(FLASH_SECTOR_ERASE_SIZE - 1u));
             }
+#endif
             usb_debug("Have flash destined page %08x (%08x %08x)\n", (uint) _uf2_info.next_task.transfer_addr,
                       (uint) *(uint32_t *) _uf2_info.next_task.data,
                       (uint) *(uint32_t *) (_uf2_info.next_task.data + 4));
+#ifndef USE_UF2_PAGE_ASSEMBLY
             assert(!(_uf2_info.next_task.transfer_addr & 0xffu));
+#endif
         }
         _uf2_info.valid_block_count++;
-        _uf2_info.valid_blocks[block_offset] |= block_mask;
+#ifdef USE_UF2_PAGE_ASSEMBLY
+        // with the last block of the image, the worker programs whatever partial pages it has left
+        _uf2_info.next_task.flush_uf2_pages = _uf2_info.valid_block_count == _uf2_info.num_blocks;
+#endif
         usb_warn("Queuing 0x%08x->0x%08x valid %d/%d checked %d/%d\n", (uint)
                 (uint) _uf2_info.next_task.transfer_addr, (uint) (_uf2_info.next_task.transfer_addr + FLASH_PAGE_SIZE),
                  (uint) _uf2_info.block_no + 1u, (uint) _uf2_info.num_blocks, (uint) _uf2_info.valid_block_count,
@@ -241,6 +529,54 @@ static bool _write_uf2_page() {
     return false; // not async
 }
 
+#ifdef USE_UF2_ERASE_AHEAD
+#ifndef UF2_ERASE_AHEAD_SECTORS
+#define UF2_ERASE_AHEAD_SECTORS 2
+#endif
+
+static void _erase_ahead_complete(struct async_task *task) {
+    if (task->result && task->token == _uf2_info.token && _uf2_info.num_blocks) {
+        // we didn't erase it after all, so let the write do it (note a failure here is generally down to
+        // interleaved writes, which will cause the subsequent UF2 writes to fail too)
+        uint page_no = UF2_PAGE_NO(task->erase_addr);
+        for (uint32_t size = 0; size < task->erase_size; size += FLASH_SECTOR_ERASE_SIZE, page_no++) {
+            if (!_block_set_remove(&_uf2_info.cleared_pages, page_no)) {
+                _uf2_info.num_blocks = 0; // can't track it any more, so the whole UF2 must be sent again
+            }
+        }
+    }
+}
+
+// Erase the (up to UF2_ERASE_AHEAD_SECTORS) sectors following the last block received, for an image which has so far
+// been entirely linear, and only within the extent its num_blocks implies. Nothing in a UF2 says whether it has address
+// gaps, and an image stops being linear only once a block past a gap arrives, so for an image with a gap this assumes
+// it doesn't; the sectors just past the end of the run of blocks before the gap may then be erased although the image
+// never writes them. A UF2 made from a single contiguous binary (as one for flash almost always is) has no gaps
+bool vd_erase_ahead_task(struct async_task *task) {
+    if (!_uf2_info.num_blocks || _uf2_info.ram || !_uf2_info.linear || virtual_disk_queue.disable) {
+        return false;
+    }
+    // (the sector the last block received ends in)
+    uint page_no = UF2_PAGE_NO(_uf2_info.linear_base + (_uf2_info.block_no + 1) * UF2_PAYLOAD_SIZE - 1u);
+    uint end_page_no = UF2_IMAGE_END_PAGE_NO();
+    for (uint i = 0; i < UF2_ERASE_AHEAD_SECTORS && page_no < end_page_no; i++) {
+        page_no++;
+        if (!_block_set_contains(&_uf2_info.cleared_pages, page_no)) {
+            reset_task(task);
+            task->token = _uf2_info.token;
+            _set_uf2_erase(task, page_no, UF2_CLEARED_BASE + page_no * FLASH_SECTOR_ERASE_SIZE);
+            task->source = TASK_SOURCE_VIRTUAL_DISK;
+            // we only get here after the first block has been written, so there should be no other mutation in between
+            task->check_last_mutation_source = true;
+            task->callback = _erase_ahead_complete;
+            uf2_debug("Erase ahead %08x\n", (uint) task->erase_addr);
+            return true;
+        }
+    }
+    return false;
+}
+#endif
+
 void vd_init() {
 }
 
@@ -262,8 +598,112 @@ void init_dir_entry(struct dir_entry *entry, const char *fn, uint cluster, uint
     entry->size = len;
 }
 
+#ifdef USE_CURRENT_UF2
+// CURRENT.UF2 is a single run of clusters following INFO_UF2.TXT, with a 512 byte UF2 block per sector
+#define CURRENT_UF2_CLUSTER 4u
+
+static uint32_t _current_uf2_num_blocks() {
+    return async_task_flash_size_log2 ? 1u << (async_task_flash_size_log2 - 8u) : 0;
+}
+
+static void _read_current_uf2_block_complete(struct async_task *task) {
+    vd_async_complete(task->token, task->result);
+}
+
+// fill in the UF2 block for flash page block_no, and queue a task to read the page into it
+static bool _read_current_uf2_block(uint32_t token, uint32_t block_no, struct uf2_block *uf2) {
+    uf2->magic_start0 = UF2_MAGIC_START0;
+    uf2->magic_start1 = UF2_MAGIC_START1;
+    uf2->flags = UF2_FLAG_FAMILY_ID_PRESENT;
+    uf2->target_addr = XIP_MAIN_BASE + block_no * FLASH_PAGE_SIZE;
+    uf2->payload_size = FLASH_PAGE_SIZE;
+    uf2->block_no = block_no;
+    uf2->num_blocks = _current_uf2_num_blocks();
+    uf2->file_size = RP2040_FAMILY_ID;
+    uf2->magic_end = UF2_MAGIC_END;
+    // (queue_task copies the task)
+    struct async_task task;
+    reset_task(&task);
+    task.token = token;
+    task.type = AT_READ;
+    task.transfer_addr = uf2->target_addr;
+    task.data = uf2->data;
+    task.data_length = FLASH_PAGE_SIZE;
+    task.source = TASK_SOURCE_VIRTUAL_DISK;
+    queue_task(&virtual_disk_queue, &task, _read_current_uf2_block_complete);
+    return true;
+}
+#endif
+
+#ifdef USE_VD_SECTOR_CACHE
+static_assert(VD_SECTOR_CACHE_SECTORS > 0, "");
+static_assert(VD_SECTOR_CACHE_BUFFER_SIZE == VD_SECTOR_CACHE_SECTORS * SECTOR_SIZE, "");
+
+// The non empty metadata sectors (partition table, boot sector, the first sector of each FAT, the root directory and
+// INDEX.HTM) are otherwise rebuilt on every read, which for INDEX.HTM means decompressing it, and hosts read them over
+// and over while mounting and after each write. Keep the most recently read ones as they were returned; everything
+// they are built from is fixed, except for the serial number and the size of CURRENT.UF2. The data lives in XIP SRAM
+// (after the UF2 assembly buffer), which a RAM download may take over
+static struct {
+    uint32_t serial_number;
+#ifdef USE_CURRENT_UF2
+    uint32_t current_uf2_num_blocks;
+#endif
+    uint32_t clock;
+    uint32_t lba_plus_one[VD_SECTOR_CACHE_SECTORS]; // 0 for an empty slot
+    uint32_t last_used[VD_SECTOR_CACHE_SECTORS]; // value of clock when the slot was last used
+    bool disabled; // a RAM write has overlapped the data
+} _sector_cache;
+
+#define _sector_cache_data(i) ((uint8_t *) (VD_SECTOR_CACHE_BUFFER_BASE + (i) * SECTOR_SIZE))
+
+void vd_sector_cache_disable() {
+    _sector_cache.disabled = true;
+}
+
+static bool _sector_cache_get(uint32_t lba, uint8_t *buf) {
+    if (_sector_cache.disabled) return false;
+    uint32_t sn = msc_get_serial_number32();
+    bool stale = sn != _sector_cache.serial_number;
+    _sector_cache.serial_number = sn;
+#ifdef USE_CURRENT_UF2
+    uint32_t current_uf2_num_blocks = _current_uf2_num_blocks();
+    stale |= current_uf2_num_blocks != _sector_cache.current_uf2_num_blocks;
+    _sector_cache.current_uf2_num_blocks = current_uf2_num_blocks;
+#endif
+    for (uint i = 0; i < VD_SECTOR_CACHE_SECTORS; i++) {
+        if (stale) {
+            _sector_cache.lba_plus_one[i] = 0;
+        } else if (_sector_cache.lba_plus_one[i] == lba + 1) {
+            _sector_cache.last_used[i] = ++_sector_cache.clock;
+            memcpy(buf, _sector_cache_data(i), SECTOR_SIZE);
+            return true;
+        }
+    }
+    return false;
+}
+
+// replaces the least recently used slot (the caller has just missed in _sector_cache_get, so lba isn't there)
+static void _sector_cache_put(uint32_t lba, const uint8_t *buf) {
+    if (_sector_cache.disabled) return;
+    uint slot = 0;
+    for (uint i = 1; i < VD_SECTOR_CACHE_SECTORS; i++) {
+        if (_sector_cache.last_used[i] < _sector_cache.last_used[slot]) slot = i;
+    }
+    _sector_cache.lba_plus_one[slot] = lba + 1;
+    _sector_cache.last_used[slot] = ++_sector_cache.clock;
+    memcpy(_sector_cache_data(slot), buf, SECTOR_SIZE);
+}
+#else
+#define _sector_cache_put(lba, buf) ((void)0)
+#endif
+
 bool vd_read_block(__unused uint32_t token, uint32_t lba, uint8_t *buf __comma_removed_for_space(uint32_t buf_size)) {
     assert(buf_size >= SECTOR_SIZE);
+#ifdef USE_VD_SECTOR_CACHE
+    if (_sector_cache_get(lba, buf)) return false;
+    uint32_t cache_lba = lba;
+#endif
     memset0(buf, SECTOR_SIZE);
 #ifndef NO_PARTITION_TABLE
     if (!lba) {
@@ -296,6 +736,7 @@ bool vd_read_block(__unused uint32_t token, uint32_t lba, uint8_t *buf __comma_r
 
         uint32_t sn = msc_get_serial_number32();
         memcpy(buf + MBR_OFFSET_SERIAL_NUMBER, &sn, 4);
+        _sector_cache_put(cache_lba, buf);
         return false;
     }
     lba--;
@@ -304,13 +745,14 @@ bool vd_read_block(__unused uint32_t token, uint32_t lba, uint8_t *buf __comma_r
         uint32_t sn = msc_get_serial_number32();
         memcpy(buf, boot_sector, sizeof(boot_sector));
         memcpy(buf + BOOT_OFFSET_SERIAL_NUMBER, &sn, 4);
+        _sector_cache_put(cache_lba, buf);
     } else {
         lba--;
         if (lba < SECTORS_PER_FAT * FAT_COUNT) {
             // mirror
             while (lba >= SECTORS_PER_FAT) lba -= SECTORS_PER_FAT;
+            uint16_t *p = (uint16_t *) buf;
             if (!lba) {
-                uint16_t *p = (uint16_t *) buf;
                 p[0] = 0xff00u | MEDIA_TYPE;
                 p[1] = 0xffff;
                 p[2] = 0xffff; // cluster2 is index.htm
@@ -318,6 +760,17 @@ bool vd_read_block(__unused uint32_t token, uint32_t lba, uint8_t *buf __comma_r
                 p[3] = 0xffff; // cluster3 is info_uf2.txt
 #endif
             }
+#ifdef USE_CURRENT_UF2
+            // each cluster of current.uf2 links to the next
+            uint32_t clusters = _current_uf2_num_blocks() >> CLUSTER_SHIFT;
+            for (uint i = 0; i < SECTOR_SIZE / 2; i++) {
+                uint32_t cluster = lba * (SECTOR_SIZE / 2) + i;
+                if (cluster - CURRENT_UF2_CLUSTER < clusters) {
+                    p[i] = cluster - CURRENT_UF2_CLUSTER == clusters - 1 ? 0xffff : cluster + 1;
+                }
+            }
+#endif
+            if (!lba) _sector_cache_put(cache_lba, buf);
         } else {
             lba -= SECTORS_PER_FAT * FAT_COUNT;
             if (lba < ROOT_DIRECTORY_SECTORS) {
@@ -331,9 +784,22 @@ bool vd_read_block(__unused uint32_t token, uint32_t lba, uint8_t *buf __comma_r
 #ifdef USE_INFO_UF2
                     init_dir_entry(++entries, "INFO_UF2TXT", 3, info_uf2_txt_len);
 #endif
+#ifdef USE_CURRENT_UF2
+                    if (_current_uf2_num_blocks()) {
+                        init_dir_entry(++entries, "CURRENT UF2", CURRENT_UF2_CLUSTER,
+                                       _current_uf2_num_blocks() * SECTOR_SIZE);
+                    }
+#endif
+                    _sector_cache_put(cache_lba, buf);
                 }
             } else {
                 lba -= ROOT_DIRECTORY_SECTORS;
+#ifdef USE_CURRENT_UF2
+                uint32_t block_no = lba - ((CURRENT_UF2_CLUSTER - 2) << CLUSTER_SHIFT);
+                if (block_no < _current_uf2_num_blocks()) {
+                    return _read_current_uf2_block(token, block_no, (struct uf2_block *) buf);
+                }
+#endif
                 uint cluster = lba >> CLUSTER_SHIFT;
                 uint cluster_offset = lba - (cluster << CLUSTER_SHIFT);
                 if (!cluster_offset) {
@@ -345,6 +811,7 @@ bool vd_read_block(__unused uint32_t token, uint32_t lba, uint8_t *buf __comma_r
                         memcpy(buf + welcome_html_version_offset_1, serial_number_string, 12);
                         memcpy(buf + welcome_html_version_offset_2, serial_number_string, 12);
 #endif
+                        _sector_cache_put(cache_lba, buf);
                     }
 #ifdef USE_INFO_UF2
                     else if (cluster == 1) {
@@ -360,21 +827,74 @@ bool vd_read_block(__unused uint32_t token, uint32_t lba, uint8_t *buf __comma_r
     return false;
 }
 
+#ifdef USE_MSC_ZERO_FILL_READS
+// this must agree with vd_read_block: the sectors it puts anything in are the partition table, the boot sector, the
+// first sector of each FAT (and the chain of CURRENT.UF2), the first sector of the root directory, the first sector of
+// INDEX.HTM and INFO_UF2.TXT, and CURRENT.UF2
+uint32_t vd_zero_sectors(uint32_t lba) {
+    uint32_t disk_sectors_left = SECTOR_COUNT - lba;
+#ifndef NO_PARTITION_TABLE
+    if (!lba) return 0;
+    lba--;
+#endif
+    if (!lba) return 0;
+    lba--;
+    if (lba < SECTORS_PER_FAT * FAT_COUNT) {
+        while (lba >= SECTORS_PER_FAT) lba -= SECTORS_PER_FAT;
+        if (!lba) return 0;
+#ifdef USE_CURRENT_UF2
+        uint32_t clusters = _current_uf2_num_blocks() >> CLUSTER_SHIFT;
+        if (clusters) {
+            uint32_t first = CURRENT_UF2_CLUSTER / (SECTOR_SIZE / 2);
+            if (lba <= (CURRENT_UF2_CLUSTER + clusters - 1) / (SECTOR_SIZE / 2)) {
+                return lba < first ? first - lba : 0;
+            }
+        }
+#endif
+        return SECTORS_PER_FAT - lba;
+    }
+    lba -= SECTORS_PER_FAT * FAT_COUNT;
+    if (lba < ROOT_DIRECTORY_SECTORS) {
+        return lba ? ROOT_DIRECTORY_SECTORS - lba : 0;
+    }
+    lba -= ROOT_DIRECTORY_SECTORS;
+    if (!lba) return 0;
+#ifdef USE_INFO_UF2
+    if (lba <= 1u << CLUSTER_SHIFT) return (1u << CLUSTER_SHIFT) - lba;
+#endif
+#ifdef USE_CURRENT_UF2
+    uint32_t first = (CURRENT_UF2_CLUSTER - 2) << CLUSTER_SHIFT;
+    if (_current_uf2_num_blocks() && lba < first + _current_uf2_num_blocks()) {
+        return lba < first ? first - lba : 0;
+    }
+#endif
+    return disk_sectors_left;
+}
+#endif
+
 #define FLASH_MAX_VALID_BLOCKS ((FLASH_BITMAPS_SIZE * 8LL * FLASH_SECTOR_ERASE_SIZE / (FLASH_PAGE_SIZE + FLASH_SECTOR_ERASE_SIZE)) & ~31u)
 #define FLASH_CLEARED_PAGES_BASE (FLASH_VALID_BLOCKS_BASE + FLASH_MAX_VALID_BLOCKS / 8)
 static_assert(!(FLASH_CLEARED_PAGES_BASE & 0x3), "");
 #define FLASH_MAX_CLEARED_PAGES (FLASH_MAX_VALID_BLOCKS * FLASH_PAGE_SIZE / FLASH_SECTOR_ERASE_SIZE)
 static_assert(FLASH_CLEARED_PAGES_BASE + (FLASH_MAX_CLEARED_PAGES / 32 - FLASH_VALID_BLOCKS_BASE <= FLASH_BITMAPS_SIZE),
               "");
-
-static void _clear_bitset(uint32_t *mask, uint32_t count) {
-    memset0(mask, count / 8);
-}
+#ifdef UF2_CLEARED_BY_FLASH_SECTOR
+// cleared_pages is indexed by flash sector, and should at least cover the 16M XIP window
+static_assert(FLASH_MAX_CLEARED_PAGES >= 0x1000000u / FLASH_SECTOR_ERASE_SIZE, "");
+#endif
 
 static bool _update_current_uf2_info(struct uf2_block *uf2, uint32_t token) {
+#ifdef USE_UF2_PAGE_ASSEMBLY
+    uint32_t length = uf2->payload_size;
+    bool ram = is_address_ram(uf2->target_addr) && is_address_ram(uf2->target_addr + length - 1);
+    bool flash = is_address_flash(uf2->target_addr) &&
+                 UF2_PAGE_NO(uf2->target_addr + length - 1) < FLASH_MAX_CLEARED_PAGES;
+    if (!(uf2->num_blocks && (ram || flash))) {
+#else
     bool ram = is_address_ram(uf2->target_addr) && is_address_ram(uf2->target_addr + (FLASH_PAGE_MASK));
     bool flash = is_address_flash(uf2->target_addr) && is_address_flash(uf2->target_addr + (FLASH_PAGE_MASK));
     if (!(uf2->num_blocks && (ram || flash)) || (flash && (uf2->target_addr & (FLASH_PAGE_MASK)))) {
+#endif
         uf2_debug("Resetting active UF2 transfer because received garbage\n");
     } else if (!virtual_disk_queue.disable) {
         // note (test abive) if virtual disk queue is disabled (and note since we're in IRQ that cannot change whilst we are executing),
@@ -386,24 +906,37 @@ static bool _update_current_uf2_info(struct uf2_block *uf2, uint32_t token) {
                       (int) uf2->num_blocks);
             memset0(&_uf2_info, sizeof(_uf2_info));
             _uf2_info.ram = ram;
-            _uf2_info.valid_blocks = ram ? uf2_valid_ram_blocks : (uint32_t *) FLASH_VALID_BLOCKS_BASE;
-            _uf2_info.max_valid_blocks = ram ? count_of(uf2_valid_ram_blocks) * 32 : FLASH_MAX_VALID_BLOCKS;
-            uf2_debug("  ram %d, so valid_blocks (max %d) %p->%p for %dK\n", ram, (int) _uf2_info.max_valid_blocks,
-                      _uf2_info.valid_blocks, _uf2_info.valid_blocks + ((_uf2_info.max_valid_blocks + 31) / 32),
-                      (uint) _uf2_info.max_valid_blocks / 4);
-            _clear_bitset(_uf2_info.valid_blocks, _uf2_info.max_valid_blocks);
+            _block_set_init(&_uf2_info.valid_blocks, ram ? uf2_valid_ram_blocks : (uint32_t *) FLASH_VALID_BLOCKS_BASE,
+                            ram ? count_of(uf2_valid_ram_blocks) * 32 : FLASH_MAX_VALID_BLOCKS);
+            uf2_debug("  ram %d, so valid_blocks (max %d) %p->%p for %dK\n", ram, (int) _uf2_info.valid_blocks.max,
+                      _uf2_info.valid_blocks.bitmap,
+                      _uf2_info.valid_blocks.bitmap + ((_uf2_info.valid_blocks.max + 31) / 32),
+                      (uint) _uf2_info.valid_blocks.max / 4);
             if (flash) {
-                _uf2_info.cleared_pages = (uint32_t *) FLASH_CLEARED_PAGES_BASE;
-                _uf2_info.max_cleared_pages = FLASH_MAX_CLEARED_PAGES;
-                uf2_debug("    cleared_pages %p->%p\n", _uf2_info.cleared_pages,
-                          _uf2_info.cleared_pages + ((_uf2_info.max_cleared_pages + 31) / 32));
-                _clear_bitset(_uf2_info.cleared_pages, _uf2_info.max_cleared_pages);
+                _block_set_init(&_uf2_info.cleared_pages, (uint32_t *) FLASH_CLEARED_PAGES_BASE,
+                                FLASH_MAX_CLEARED_PAGES);
+                uf2_debug("    cleared_pages %p->%p\n", _uf2_info.cleared_pages.bitmap,
+                          _uf2_info.cleared_pages.bitmap + ((_uf2_info.cleared_pages.max + 31) / 32));
+#ifdef USE_UF2_PAGE_ASSEMBLY
+                _uf2_info.payload_size = length;
+#endif
+#ifdef UF2_TRACK_LINEAR
+                uint32_t linear_base = uf2->target_addr - uf2->block_no * UF2_PAYLOAD_SIZE;
+                uint32_t flash_end = _flash_end();
+                _uf2_info.linear_base = linear_base;
+                _uf2_info.linear = !(linear_base & (FLASH_SECTOR_ERASE_SIZE - 1u)) && linear_base >= XIP_MAIN_BASE &&
+                                   linear_base < flash_end;
+                _uf2_info.image_end = uf2->num_blocks < (flash_end - linear_base) / UF2_PAYLOAD_SIZE ?
+                                      linear_base + uf2->num_blocks * UF2_PAYLOAD_SIZE : flash_end;
+#endif
             }
 
-            if (uf2->num_blocks > _uf2_info.max_valid_blocks) {
+#ifndef USE_UF2_BLOCK_INTERVALS
+            if (uf2->num_blocks > _uf2_info.valid_blocks.max) {
                 uf2_debug("Oops image requires %d blocks and won't fit", (uint) uf2->num_blocks);
                 return false;
             }
+#endif
             usb_warn("New UF2 transfer\n");
             _uf2_info.num_blocks = uf2->num_blocks;
             _uf2_info.valid_block_count = 0;
@@ -414,17 +947,28 @@ static bool _update_current_uf2_info(struct uf2_block *uf2, uint32_t token) {
             uf2_debug("Ignoring write to out of range address 0x%08x->0x%08x\n",
                       (uint) uf2->target_addr, (uint) (uf2->target_addr + uf2->payload_size));
         } else {
-            assert(uf2->num_blocks <= _uf2_info.max_valid_blocks);
+#ifndef USE_UF2_BLOCK_INTERVALS
+            assert(uf2->num_blocks <= _uf2_info.valid_blocks.max);
+#endif
             if (uf2->block_no < uf2->num_blocks) {
                 // set up next task state (also serves as a holder for state scoped to this block write to avoid copying data around)
                 reset_task(&_uf2_info.next_task);
                 _uf2_info.block_no = uf2->block_no;
+#ifdef UF2_TRACK_LINEAR
+                if (uf2->target_addr != _uf2_info.linear_base + uf2->block_no * UF2_PAYLOAD_SIZE) {
+                    _uf2_info.linear = false;
+                }
+#endif
                 _uf2_info.token = _uf2_info.next_task.token = token;
                 _uf2_info.next_task.transfer_addr = uf2->target_addr;
                 _uf2_info.next_task.type = type;
                 _uf2_info.next_task.data = uf2->data;
                 _uf2_info.next_task.callback = _write_uf2_page_complete;
+#ifdef USE_UF2_PAGE_ASSEMBLY
+                _uf2_info.next_task.data_length = length; // the worker assembles flash pages
+#else
                 _uf2_info.next_task.data_length = FLASH_PAGE_SIZE; // always a full page
+#endif
                 _uf2_info.next_task.source = TASK_SOURCE_VIRTUAL_DISK;
                 return true;
             } else {
@@ -443,7 +987,12 @@ bool vd_write_block(uint32_t token, __unused uint32_t lba, uint8_t *buf __comma_
     if (uf2->magic_start0 == UF2_MAGIC_START0 && uf2->magic_start1 == UF2_MAGIC_START1 &&
         uf2->magic_end == UF2_MAGIC_END) {
         if (uf2->flags & UF2_FLAG_FAMILY_ID_PRESENT && uf2->file_size == RP2040_FAMILY_ID &&
+#ifdef USE_UF2_PAGE_ASSEMBLY
+            !(uf2->flags & UF2_FLAG_NOT_MAIN_FLASH) && uf2->payload_size &&
+            uf2->payload_size <= sizeof(uf2->data)) {
+#else
             !(uf2->flags & UF2_FLAG_NOT_MAIN_FLASH) && uf2->payload_size == 256) {
+#endif
             if (_update_current_uf2_info(uf2, token)) {
                 // if we have a valid uf2 page, write it
                 return _write_uf2_page();
@@ -0,0 +1,29 @@
+/**
+ * Copyright (c) 2020 Raspberry Pi (Trading) Ltd.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#ifndef _SIM_HARDWARE_ADDRESS_MAPPED_H
+#define _SIM_HARDWARE_ADDRESS_MAPPED_H
+
+#include <stddef.h>
+#include "pico.h"
+
+// the register types and accessors of the SDK's address_mapped.h used by program_flash_generic.c; the simulator has
+// no atomic set/clear aliases, so these are plain read-modify-writes
+typedef volatile uint32_t io_rw_32;
+typedef const volatile uint32_t io_ro_32;
+typedef volatile uint32_t io_wo_32;
+
+#define check_hw_layout(type, member, offset) static_assert(offsetof(type, member) == (offset), "hw offset mismatch")
+
+static inline void hw_set_bits(io_rw_32 *addr, uint32_t mask) {
+    *addr |= mask;
+}
+
+static inline void hw_clear_bits(io_rw_32 *addr, uint32_t mask) {
+    *addr &= ~mask;
+}
+
+#endif
@@ -0,0 +1,14 @@
+/**
+ * Copyright (c) 2020 Raspberry Pi (Trading) Ltd.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#ifndef _SIM_HARDWARE_REGS_INTCTRL_H
+#define _SIM_HARDWARE_REGS_INTCTRL_H
+
+// the USB controller is the only "IRQ" the simulator has
+#define USBCTRL_IRQ 5
+#define N_IRQS 32
+
+#endif
@@ -0,0 +1,22 @@
+/**
+ * Copyright (c) 2020 Raspberry Pi (Trading) Ltd.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#ifndef _SIM_HARDWARE_REGS_IO_QSPI_H
+#define _SIM_HARDWARE_REGS_IO_QSPI_H
+
+// the QSPI IO bank registers program_flash_generic.c uses
+#define IO_QSPI_GPIO_QSPI_SS_CTRL_OFFSET 0x0000000c
+#define IO_QSPI_GPIO_QSPI_SS_CTRL_OUTOVER_BITS 0x00000300
+#define IO_QSPI_GPIO_QSPI_SS_CTRL_OUTOVER_LSB 8
+#define IO_QSPI_GPIO_QSPI_SS_CTRL_OUTOVER_VALUE_NORMAL 0x0
+#define IO_QSPI_GPIO_QSPI_SS_CTRL_OUTOVER_VALUE_LOW 0x2
+#define IO_QSPI_GPIO_QSPI_SS_CTRL_OUTOVER_VALUE_HIGH 0x3
+#define IO_QSPI_GPIO_QSPI_SD1_CTRL_OFFSET 0x0000001c
+#define IO_QSPI_GPIO_QSPI_SD1_CTRL_INOVER_BITS 0x00030000
+#define IO_QSPI_GPIO_QSPI_SD1_CTRL_INOVER_LSB 16
+#define IO_QSPI_GPIO_QSPI_SD1_CTRL_INOVER_VALUE_LOW 0x2
+
+#endif
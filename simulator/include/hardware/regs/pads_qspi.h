@@ -0,0 +1,16 @@
+/**
+ * Copyright (c) 2020 Raspberry Pi (Trading) Ltd.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#ifndef _SIM_HARDWARE_REGS_PADS_QSPI_H
+#define _SIM_HARDWARE_REGS_PADS_QSPI_H
+
+// the QSPI pad control registers program_flash_generic.c uses
+#define PADS_QSPI_GPIO_QSPI_SD0_OFFSET 0x00000008
+#define PADS_QSPI_GPIO_QSPI_SD0_OD_BITS 0x00000080
+#define PADS_QSPI_GPIO_QSPI_SD0_PUE_BITS 0x00000008
+#define PADS_QSPI_GPIO_QSPI_SD0_PDE_BITS 0x00000004
+
+#endif
@@ -0,0 +1,50 @@
+/**
+ * Copyright (c) 2020 Raspberry Pi (Trading) Ltd.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#ifndef _SIM_HARDWARE_REGS_SSI_H
+#define _SIM_HARDWARE_REGS_SSI_H
+
+// the SSI registers and fields program_flash_generic.c (and the simulator's model of them in sim_ssi.c) use
+#define SSI_CTRLR0_OFFSET 0x00000000
+#define SSI_CTRLR0_SPI_FRF_BITS 0x00600000
+#define SSI_CTRLR0_SPI_FRF_LSB 21
+#define SSI_CTRLR0_SPI_FRF_VALUE_STD 0x0
+#define SSI_CTRLR0_SPI_FRF_VALUE_QUAD 0x2
+#define SSI_CTRLR0_DFS_32_BITS 0x001f0000
+#define SSI_CTRLR0_DFS_32_LSB 16
+#define SSI_CTRLR0_TMOD_BITS 0x00000300
+#define SSI_CTRLR0_TMOD_LSB 8
+#define SSI_CTRLR0_TMOD_VALUE_TX_AND_RX 0x0
+#define SSI_CTRLR0_TMOD_VALUE_TX_ONLY 0x1
+#define SSI_CTRLR0_TMOD_VALUE_RX_ONLY 0x2
+#define SSI_CTRLR0_TMOD_VALUE_EEPROM_READ 0x3
+#define SSI_CTRLR1_OFFSET 0x00000004
+#define SSI_SSIENR_OFFSET 0x00000008
+#define SSI_BAUDR_OFFSET 0x00000014
+#define SSI_TXFLR_OFFSET 0x00000020
+#define SSI_RXFLR_OFFSET 0x00000024
+#define SSI_SR_OFFSET 0x00000028
+#define SSI_SR_BUSY_BITS 0x00000001
+#define SSI_SR_TFNF_BITS 0x00000002
+#define SSI_SR_TFE_BITS 0x00000004
+#define SSI_SR_RFNE_BITS 0x00000008
+#define SSI_DMACR_OFFSET 0x0000004c
+#define SSI_DMACR_TDMAE_BITS 0x00000002
+#define SSI_DMACR_RDMAE_BITS 0x00000001
+#define SSI_DR0_OFFSET 0x00000060
+#define SSI_SPI_CTRLR0_OFFSET 0x000000f4
+#define SSI_SPI_CTRLR0_XIP_CMD_LSB 24
+#define SSI_SPI_CTRLR0_WAIT_CYCLES_BITS 0x0000f800
+#define SSI_SPI_CTRLR0_WAIT_CYCLES_LSB 11
+#define SSI_SPI_CTRLR0_INST_L_BITS 0x00000300
+#define SSI_SPI_CTRLR0_INST_L_LSB 8
+#define SSI_SPI_CTRLR0_ADDR_L_BITS 0x0000003c
+#define SSI_SPI_CTRLR0_ADDR_L_LSB 2
+#define SSI_SPI_CTRLR0_TRANS_TYPE_BITS 0x00000003
+#define SSI_SPI_CTRLR0_TRANS_TYPE_LSB 0
+#define SSI_SPI_CTRLR0_TRANS_TYPE_VALUE_1C1A 0x0
+
+#endif
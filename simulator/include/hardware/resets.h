@@ -0,0 +1,15 @@
+/**
+ * Copyright (c) 2020 Raspberry Pi (Trading) Ltd.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#ifndef _SIM_HARDWARE_RESETS_H
+#define _SIM_HARDWARE_RESETS_H
+
+// reset bits of the blocks program_flash_generic.c resets (sim_ssi.c resets the simulated registers)
+#define RESETS_RESET_DMA_BITS 0x00000004u
+#define RESETS_RESET_IO_QSPI_BITS 0x00000040u
+#define RESETS_RESET_PADS_QSPI_BITS 0x00000200u
+
+#endif
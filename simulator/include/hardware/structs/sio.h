@@ -0,0 +1,12 @@
+/**
+ * Copyright (c) 2020 Raspberry Pi (Trading) Ltd.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#ifndef _SIM_HARDWARE_STRUCTS_SIO_H
+#define _SIM_HARDWARE_STRUCTS_SIO_H
+
+// nothing needed (the simulator is built without USE_BOOTROM_GPIO)
+
+#endif
@@ -0,0 +1,21 @@
+/**
+ * Copyright (c) 2020 Raspberry Pi (Trading) Ltd.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#ifndef _SIM_HARDWARE_STRUCTS_TIMER_H
+#define _SIM_HARDWARE_STRUCTS_TIMER_H
+
+#include <stdint.h>
+
+// only the raw count is used; the simulator keeps it at the current virtual time in microseconds
+typedef struct {
+    volatile uint32_t timerawh;
+    volatile uint32_t timerawl;
+} timer_hw_t;
+
+extern timer_hw_t sim_timer_hw;
+#define timer_hw (&sim_timer_hw)
+
+#endif
@@ -0,0 +1,12 @@
+/**
+ * Copyright (c) 2020 Raspberry Pi (Trading) Ltd.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#ifndef _SIM_HARDWARE_STRUCTS_USB_H
+#define _SIM_HARDWARE_STRUCTS_USB_H
+
+// nothing needed; the USB device layer is replaced by sim_usb.c
+
+#endif
@@ -0,0 +1,23 @@
+/**
+ * Copyright (c) 2020 Raspberry Pi (Trading) Ltd.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#ifndef _SIM_HARDWARE_STRUCTS_XIP_CTRL_H
+#define _SIM_HARDWARE_STRUCTS_XIP_CTRL_H
+
+#include "hardware/address_mapped.h"
+
+// the simulator maps these (with no behaviour) at XIP_CTRL_BASE
+typedef struct {
+    io_rw_32 ctrl;
+    io_rw_32 flush;
+    io_ro_32 stat;
+} xip_ctrl_hw_t;
+
+#define XIP_CTRL_EN_BITS 0x00000001
+
+#define xip_ctrl_hw ((xip_ctrl_hw_t *) XIP_CTRL_BASE)
+
+#endif
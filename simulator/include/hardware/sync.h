@@ -0,0 +1,23 @@
+/**
+ * Copyright (c) 2020 Raspberry Pi (Trading) Ltd.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#ifndef _SIM_HARDWARE_SYNC_H
+#define _SIM_HARDWARE_SYNC_H
+
+#include "pico.h"
+
+// the simulator is single threaded; "IRQs" (host USB activity) are only delivered while the worker is waiting
+// for flash operations or in __wfe, so these just track state for checking
+uint32_t save_and_disable_interrupts(void);
+void restore_interrupts(uint32_t status);
+void __sev(void);
+void __wfe(void);
+
+static inline void __dmb(void) {}
+static inline void __mem_fence_acquire(void) {}
+static inline void __mem_fence_release(void) {}
+
+#endif
@@ -0,0 +1,45 @@
+/**
+ * Copyright (c) 2020 Raspberry Pi (Trading) Ltd.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+// Host stand-in for the parts of the SDK's pico.h used by the bootrom sources compiled into the simulator
+
+#ifndef _SIM_PICO_H
+#define _SIM_PICO_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+#include <assert.h>
+#include "pico/types.h"
+
+#define __aligned(x) __attribute__((aligned(x)))
+#define __packed __attribute__((packed))
+#define __noinline __attribute__((noinline))
+#define __unused __attribute__((unused))
+#define __used __attribute__((used))
+#define __isr
+
+// address map (these regions are backed by host memory at the same addresses where the code dereferences them)
+#define SRAM_BASE 0x20000000u
+#define SRAM_END 0x20042000u
+#define XIP_BASE 0x10000000u
+#define XIP_MAIN_BASE 0x10000000u
+#define XIP_SRAM_BASE 0x15000000u
+#define XIP_SRAM_END 0x15004000u
+// (with SIM_FLASH_SSI, sim_ssi.c traps accesses to these to model the registers)
+#define XIP_CTRL_BASE 0x14000000u
+#define XIP_SSI_BASE 0x18000000u
+#define IO_QSPI_BASE 0x40018000u
+#define PADS_QSPI_BASE 0x40020000u
+
+extern void sim_panic(const char *fmt, ...);
+
+static inline void __breakpoint(void) {
+    sim_panic("breakpoint");
+}
+
+#endif
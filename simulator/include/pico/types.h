@@ -0,0 +1,19 @@
+/**
+ * Copyright (c) 2020 Raspberry Pi (Trading) Ltd.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#ifndef _SIM_PICO_TYPES_H
+#define _SIM_PICO_TYPES_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef unsigned int uint;
+
+// the SDK's pico/types.h brings in the compiler attribute macros too
+#include "pico.h"
+
+#endif
@@ -0,0 +1,120 @@
+/**
+ * Copyright (c) 2020 Raspberry Pi (Trading) Ltd.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#ifndef _SIM_H
+#define _SIM_H
+
+// Host side simulator for the async task engine; the bootrom's virtual disk, MSC and async task code are compiled
+// unchanged, with the USB hardware replaced by a scripted host (sim_usb.c) and the flash by a timed NOR model (sim_flash.c)
+//
+// Everything runs on a single thread in virtual time: the worker loop (async_task_worker) is the "thread mode" code,
+// and host USB transactions are delivered as "IRQs" whenever the worker spends (virtual) time waiting on the flash or in __wfe
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// runtime.h compiles printf out of the bootrom code; the simulator's own code (which includes this header after
+// the bootrom headers) wants the real thing
+#undef printf
+#undef puts
+
+// ---- virtual time (sim_runtime.c)
+
+// current virtual time in nanoseconds
+uint64_t sim_time_ns();
+
+// called by the flash model to account for time spent on an operation; host USB activity scheduled during this
+// time is delivered (if "IRQs" are enabled)
+void sim_advance_ns(uint64_t ns);
+
+// called (from the worker in __wfe) when the host has nothing left to do and the worker is idle
+void __attribute__((noreturn)) sim_finish();
+
+// true once the bootrom has asked to reboot (i.e. it has seen the whole UF2)
+bool sim_reboot_requested();
+
+extern bool sim_verbose;
+
+// ---- flash model (sim_flash.c)
+
+struct sim_flash_timing {
+    uint32_t spi_ns_per_byte;
+    uint32_t page_program_us;
+    uint32_t sector_erase_us;
+    uint32_t block_erase_32k_us;
+    uint32_t block_erase_64k_us;
+    uint32_t xip_mode_change_us;
+    uint32_t min_baud_div; // smallest SSI clock divider at which reads are reliable (03h reads need 2 more)
+};
+
+struct sim_flash_counters {
+    uint32_t page_programs;
+    uint32_t sector_erases;
+    uint32_t block_erases_32k;
+    uint32_t block_erases_64k;
+    uint32_t reads;
+    uint64_t bytes_read;
+    // programs which tried to set a bit that was already 0 (which NOR flash can't do)
+    uint32_t programs_not_erased;
+    uint64_t busy_ns;
+};
+
+extern struct sim_flash_timing sim_flash_timing;
+extern struct sim_flash_counters sim_flash_counters;
+
+void sim_flash_init(uint32_t size);
+uint32_t sim_flash_size();
+// direct access to the flash array (for preloading and verification); offset is from the start of flash
+uint8_t *sim_flash_contents(uint32_t offset);
+// the SSI clock divider currently in use
+uint32_t sim_flash_baud_div();
+// flash offset of a page which programs leave unchanged (to exercise USE_FLASH_VERIFY), or ~0u for none
+extern uint32_t sim_flash_bad_page;
+
+#ifdef SIM_FLASH_SSI
+// the flash's side of the bus, for the SSI model (sim_ssi.c): chip select, and one byte each way
+void sim_flash_select();
+void sim_flash_deselect();
+uint8_t sim_flash_shift(uint8_t tx);
+void sim_flash_set_baud_div(uint32_t div);
+
+// ---- SSI, QSPI IO/pad and XIP control registers (sim_ssi.c)
+
+// map the registers, trapping accesses to them
+void sim_ssi_init();
+#endif
+
+// ---- USB host (sim_usb.c)
+
+struct sim_usb_config {
+    uint32_t packet_ns; // time for one bulk transaction (data or NAK) on the bus
+    uint32_t sectors_per_command; // WRITE_10 size used by the host
+    uint32_t lba; // where on the disk the host writes the file
+    bool read_current_uf2; // read the whole of CURRENT.UF2 before writing the file
+    uint32_t read_empty_sectors; // and with it, this many of the (empty) sectors following it
+};
+
+extern struct sim_usb_config sim_usb_config;
+
+// set up the MSC endpoints and queue WRITE_10 commands for the data
+void sim_usb_init(const uint8_t *data, uint32_t sector_count);
+// time of the next host bus transaction, or UINT64_MAX if the host has finished
+uint64_t sim_usb_next_event_ns();
+// perform the host transaction due at sim_usb_next_event_ns() ("IRQ" context)
+void sim_usb_step();
+bool sim_usb_done();
+// virtual time from the start of the write to the host receiving the final CSW
+uint64_t sim_usb_done_ns();
+// time of the last bus transaction that was not NAKed
+uint64_t sim_usb_last_progress_ns();
+uint32_t sim_usb_naks();
+uint32_t sim_usb_failed_commands();
+// the CURRENT.UF2 the host read back (if sim_usb_config.read_current_uf2), and how long that took
+const uint8_t *sim_usb_current_uf2(uint32_t *sector_count);
+uint64_t sim_usb_current_uf2_ns();
+
+#endif
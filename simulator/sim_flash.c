@@ -0,0 +1,616 @@
+/**
+ * Copyright (c) 2020 Raspberry Pi (Trading) Ltd.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+// Timed model of a serial NOR flash (loosely a Winbond W25Qxx) standing in for program_flash_generic.c, or with
+// SIM_FLASH_SSI, on the other end of the SSI model (sim_ssi.c) which the real program_flash_generic.c drives.
+//
+// Commands are interpreted a byte at a time as they are "shifted" over the bus, and take effect when chip select is
+// released, as with a real part. Program and erase then leave the part busy for the configured time, during which
+// the bootrom's status register polling advances virtual time. The model enforces NOR semantics:
+//
+// - program can only clear bits (data is ANDed into the array), and wraps within the 256 byte page
+// - erase requires the address to be aligned to the erase size
+// - program/erase require a prior write enable, and no command other than read status is accepted while busy
+// - quad commands require the QE bit (bit 1 of status register 2) to be set
+//
+// Violations of the latter two are bootrom bugs, so they stop the simulation.
+//
+// The SPI clock follows the SSI clock divider, and below sim_flash_timing.min_baud_div (2 more for 03h reads) the data
+// read back is corrupted (as if sampled a bit late), as happens when board delays limit the clock.
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/param.h>
+#include "pico.h"
+#include "hardware/sync.h"
+#include "sim.h"
+#include "program_flash_generic.h"
+
+#define FLASHCMD_WRITE_STATUS     0x01
+#define FLASHCMD_PAGE_PROGRAM     0x02
+#define FLASHCMD_READ_DATA        0x03
+#define FLASHCMD_WRITE_DISABLE    0x04
+#define FLASHCMD_READ_STATUS      0x05
+#define FLASHCMD_WRITE_ENABLE     0x06
+#define FLASHCMD_FAST_READ        0x0b
+#define FLASHCMD_SECTOR_ERASE     0x20
+#define FLASHCMD_WRITE_STATUS2    0x31
+#define FLASHCMD_QUAD_PAGE_PROGRAM 0x32
+#define FLASHCMD_READ_STATUS2     0x35
+#define FLASHCMD_BLOCK_ERASE_32K  0x52
+#define FLASHCMD_READ_SFDP        0x5a
+#define FLASHCMD_QUAD_READ        0x6b
+#define FLASHCMD_READ_JEDEC_ID    0x9f
+#define FLASHCMD_BLOCK_ERASE_64K  0xd8
+
+// versions of the address-taking commands with a 4-byte address, for parts larger than 16MB (the model only takes
+// 3-byte addresses otherwise, as it has no 4-byte address mode)
+static const uint8_t _cmds_4_byte_addr[][2] = {
+        {0x12, FLASHCMD_PAGE_PROGRAM},
+        {0x13, FLASHCMD_READ_DATA},
+        {0x0c, FLASHCMD_FAST_READ},
+        {0x21, FLASHCMD_SECTOR_ERASE},
+        {0x5c, FLASHCMD_BLOCK_ERASE_32K},
+        {0xdc, FLASHCMD_BLOCK_ERASE_64K},
+        {0x34, FLASHCMD_QUAD_PAGE_PROGRAM},
+        {0x6c, FLASHCMD_QUAD_READ},
+};
+
+#define STATUS_WIP 0x01u
+#define STATUS_WEL 0x02u
+#define STATUS2_QE 0x02u
+
+struct sim_flash_timing sim_flash_timing = {
+        .spi_ns_per_byte = 1000, // clk_sys 48MHz / baudr 6 (scaled for other dividers), and the put_get loop keeps up
+        .page_program_us = 400,
+        .sector_erase_us = 45000,
+        .block_erase_32k_us = 120000,
+        .block_erase_64k_us = 150000,
+        .xip_mode_change_us = 20,
+        .min_baud_div = 2,
+};
+
+struct sim_flash_counters sim_flash_counters;
+uint32_t sim_flash_bad_page = ~0u;
+
+static uint8_t *_array;
+static uint32_t _size;
+
+static struct {
+    bool selected;
+    uint32_t pos; // number of bytes shifted in this transaction
+    uint8_t cmd; // (a 4-byte address command is held as its 3-byte address equivalent)
+    uint32_t addr_bytes; // of the current command: 0, 3 or 4
+    uint32_t addr;
+    uint32_t baud_div;
+    uint8_t status;
+    uint8_t status2;
+    bool aborted;
+    uint64_t busy_until_ns;
+    // page program data is latched and written on CS high
+    uint8_t page_buf[256];
+    bool page_buf_used[256];
+    // as is status register write data
+    uint8_t status_buf[2];
+} _flash;
+
+#define SFDP_BFPT_WORDS 16
+
+// minimal SFDP: header, one (mandatory) parameter header, and a JESD216B basic flash parameter table
+static uint8_t _sfdp[0x30 + SFDP_BFPT_WORDS * 4];
+
+static void _sfdp_init() {
+    uint8_t *p = _sfdp;
+    memcpy(p, "SFDP", 4);
+    p[4] = 0; // minor rev
+    p[5] = 1; // major rev
+    p[6] = 0; // number of parameter headers - 1
+    p[7] = 0xff;
+    // parameter header 0: JEDEC basic flash parameter table
+    p[8] = 0; // ID
+    p[9] = 0; // minor
+    p[10] = 1; // major
+    p[11] = SFDP_BFPT_WORDS; // length in DWORDs
+    p[12] = 0x30; // pointer
+    p[13] = 0;
+    p[14] = 0;
+    p[15] = 0xff;
+    uint32_t bfpt[SFDP_BFPT_WORDS] = {
+            // 4K erase supported with 0x20, write granularity 64+, volatile SR, 1-1-4 & 1-4-4 read, and beyond 16M
+            // 3 or 4-byte addresses
+            0xfff120e5u | (_size > 0x1000000u ? 1u << 17u : 0),
+            _size * 8u - 1u, // density in bits - 1
+            0x6b08eb44u, // 1-4-4 read with 0xeb (2 mode + 4 wait), 1-1-4 read with 0x6b (8 wait)
+            0, 0, 0, 0,
+            0x520f200cu, // erase type 1: 4K (2^12) with 0x20, erase type 2: 32K (2^15) with 0x52
+            0x0000d810u, // erase type 3: 64K (2^16) with 0xd8
+            // typical erase times: 4K 3 x 16ms, 32K 1 x 128ms, 64K 10 x 16ms
+            (0x22u << 4u) | (0x40u << 11u) | (0x29u << 18u) | 1u,
+            0x00002581u, // 256 byte pages, typical page program 6 x 64us
+            0, // suspend/resume supported (the model doesn't implement it, but only PICOBOOT reads would use it)
+            0x757a757au, // erase and program suspend 0x75, resume 0x7a
+            0,
+            0x00400000u, // quad enable requirement 4: QE is bit 1 of SR2, read with 0x35 and written with 0x01
+            0,
+    };
+    for (uint i = 0; i < SFDP_BFPT_WORDS; i++) {
+        for (uint b = 0; b < 4; b++) {
+            _sfdp[0x30 + i * 4 + b] = (uint8_t) (bfpt[i] >> (b * 8u));
+        }
+    }
+}
+
+void sim_flash_init(uint32_t size) {
+    if (!size || (size & (size - 1)) || size > 256u * 1024 * 1024) {
+        sim_panic("flash size must be a power of 2 no more than 256M");
+    }
+    free(_array);
+    _size = size;
+    _array = malloc(size);
+    memset(_array, 0xff, size);
+    memset(&_flash, 0, sizeof(_flash));
+    _flash.baud_div = FLASH_BAUD_DIV_DEFAULT;
+    memset(&sim_flash_counters, 0, sizeof(sim_flash_counters));
+    _sfdp_init();
+}
+
+uint32_t sim_flash_size() {
+    return _size;
+}
+
+uint8_t *sim_flash_contents(uint32_t offset) {
+    return _array + (offset & (_size - 1));
+}
+
+static bool _busy() {
+    return sim_time_ns() < _flash.busy_until_ns;
+}
+
+static void _set_busy(uint32_t us) {
+    _flash.busy_until_ns = sim_time_ns() + us * 1000ull;
+    sim_flash_counters.busy_ns += us * 1000ull;
+}
+
+static bool _cmd_has_addr(uint8_t cmd) {
+    switch (cmd) {
+        case FLASHCMD_PAGE_PROGRAM:
+        case FLASHCMD_QUAD_PAGE_PROGRAM:
+        case FLASHCMD_READ_DATA:
+        case FLASHCMD_FAST_READ:
+        case FLASHCMD_QUAD_READ:
+        case FLASHCMD_SECTOR_ERASE:
+        case FLASHCMD_BLOCK_ERASE_32K:
+        case FLASHCMD_READ_SFDP:
+        case FLASHCMD_BLOCK_ERASE_64K:
+            return true;
+        default:
+            return false;
+    }
+}
+
+static void _select() {
+    if (!_flash.selected) {
+        _flash.selected = true;
+        _flash.pos = 0;
+    }
+}
+
+static void _check_write_enabled(const char *what) {
+    if (!(_flash.status & STATUS_WEL)) {
+        sim_panic("flash %s at %06x without write enable", what, (uint) _flash.addr);
+    }
+}
+
+static void _erase(uint32_t size, uint32_t us) {
+    _check_write_enabled("erase");
+    if (_flash.addr & (size - 1)) {
+        sim_panic("flash erase of %dK at misaligned address %06x", (int) (size / 1024), (uint) _flash.addr);
+    }
+    memset(_array + (_flash.addr & (_size - 1)), 0xff, size);
+    _set_busy(us);
+    switch (size) {
+        case 4096:
+            sim_flash_counters.sector_erases++;
+            break;
+        case 32768:
+            sim_flash_counters.block_erases_32k++;
+            break;
+        default:
+            sim_flash_counters.block_erases_64k++;
+            break;
+    }
+}
+
+static void _deselect() {
+    if (!_flash.selected) return;
+    _flash.selected = false;
+    if (_flash.pos < 1 + _flash.addr_bytes) return; // incomplete command is ignored
+    switch (_flash.cmd) {
+        case FLASHCMD_WRITE_ENABLE:
+            _flash.status |= STATUS_WEL;
+            return;
+        case FLASHCMD_WRITE_DISABLE:
+            _flash.status &= ~STATUS_WEL;
+            return;
+        case FLASHCMD_WRITE_STATUS:
+            _check_write_enabled("status write");
+            _flash.status = (_flash.status & (STATUS_WIP | STATUS_WEL)) | (_flash.status_buf[0] & ~(STATUS_WIP | STATUS_WEL));
+            // writing SR1 alone clears SR2 on some parts, so model that
+            _flash.status2 = _flash.pos > 2 ? _flash.status_buf[1] : 0;
+            _set_busy(10000);
+            break;
+        case FLASHCMD_WRITE_STATUS2:
+            _check_write_enabled("status write");
+            _flash.status2 = _flash.status_buf[0];
+            _set_busy(10000);
+            break;
+        case FLASHCMD_PAGE_PROGRAM:
+        case FLASHCMD_QUAD_PAGE_PROGRAM: {
+            _check_write_enabled("program");
+            uint32_t page = _flash.addr & ~0xffu & (_size - 1);
+            bool not_erased = false;
+            for (uint i = 0; i < 256 && page != sim_flash_bad_page; i++) {
+                if (_flash.page_buf_used[i]) {
+                    uint8_t *p = _array + page + i;
+                    if (_flash.page_buf[i] & ~*p) not_erased = true;
+                    *p &= _flash.page_buf[i];
+                }
+            }
+            if (not_erased) sim_flash_counters.programs_not_erased++;
+            sim_flash_counters.page_programs++;
+            _set_busy(sim_flash_timing.page_program_us);
+            break;
+        }
+        case FLASHCMD_SECTOR_ERASE:
+            _erase(4096, sim_flash_timing.sector_erase_us);
+            break;
+        case FLASHCMD_BLOCK_ERASE_32K:
+            _erase(32768, sim_flash_timing.block_erase_32k_us);
+            break;
+        case FLASHCMD_BLOCK_ERASE_64K:
+            _erase(65536, sim_flash_timing.block_erase_64k_us);
+            break;
+        default:
+            return;
+    }
+    // program/erase/write status clear WEL on completion; we model it as cleared immediately
+    _flash.status &= ~STATUS_WEL;
+}
+
+static bool _cmd_is_quad(uint8_t cmd) {
+    return cmd == FLASHCMD_QUAD_PAGE_PROGRAM || cmd == FLASHCMD_QUAD_READ;
+}
+
+static uint8_t _shift_in(uint8_t tx) {
+    assert(_flash.selected);
+    uint32_t pos = _flash.pos++;
+    // the data phase of quad commands (after the address and for reads, a dummy byte) moves 4 bits per clock
+    bool quad_data = _cmd_is_quad(_flash.cmd) && pos > _flash.addr_bytes + (_flash.cmd == FLASHCMD_QUAD_READ ? 1 : 0);
+    uint32_t ns_per_byte = sim_flash_timing.spi_ns_per_byte * _flash.baud_div / FLASH_BAUD_DIV_DEFAULT;
+    sim_advance_ns(quad_data ? ns_per_byte / 4 : ns_per_byte);
+    if (!pos) {
+        _flash.cmd = tx;
+        _flash.addr_bytes = _cmd_has_addr(tx) ? 3 : 0;
+        for (uint i = 0; i < sizeof(_cmds_4_byte_addr) / 2 && _size > 0x1000000u; i++) {
+            if (_cmds_4_byte_addr[i][0] == tx) {
+                _flash.cmd = _cmds_4_byte_addr[i][1];
+                _flash.addr_bytes = 4;
+            }
+        }
+        _flash.addr = 0;
+        memset(_flash.page_buf_used, 0, sizeof(_flash.page_buf_used));
+        if (_busy() && tx != FLASHCMD_READ_STATUS && tx != FLASHCMD_READ_STATUS2) {
+            sim_panic("flash command %02x issued while busy", tx);
+        }
+        if (_cmd_is_quad(_flash.cmd) && !(_flash.status2 & STATUS2_QE)) {
+            sim_panic("quad flash command %02x issued without QE set", tx);
+        }
+        return 0xff;
+    }
+    if (pos <= _flash.addr_bytes) {
+        _flash.addr = (_flash.addr << 8u) | tx;
+        return 0xff;
+    }
+    uint32_t data_pos = pos - 1 - _flash.addr_bytes;
+    switch (_flash.cmd) {
+        case FLASHCMD_WRITE_STATUS:
+        case FLASHCMD_WRITE_STATUS2:
+            if (data_pos < 2) _flash.status_buf[data_pos] = tx;
+            return 0xff;
+        case FLASHCMD_READ_STATUS:
+#ifdef SIM_FLASH_SSI
+            // every register access the driver makes costs a couple of host signals, so rather than have it poll its way
+            // through a busy period, move time on to whichever comes first of the part becoming ready and the next host
+            // transaction (which may want to suspend an erase; one already overdue is waiting for IRQs to be enabled)
+            if (_busy()) {
+                uint64_t until = _flash.busy_until_ns, next = sim_usb_next_event_ns();
+                if (next > sim_time_ns()) until = MIN(until, next);
+                sim_advance_ns(until - sim_time_ns());
+            }
+#endif
+            return _flash.status | (_busy() ? STATUS_WIP : 0);
+        case FLASHCMD_READ_STATUS2:
+            return _flash.status2;
+        case FLASHCMD_READ_JEDEC_ID: {
+            static const uint8_t jedec_id[3] = {0xef, 0x40, 0};
+            if (data_pos == 2) return (uint8_t) __builtin_ctz(_size);
+            return data_pos < 3 ? jedec_id[data_pos] : 0xff;
+        }
+        case FLASHCMD_READ_SFDP:
+            if (!data_pos) return 0xff; // dummy byte
+            data_pos--;
+            // fall through
+        case FLASHCMD_READ_DATA:
+        case FLASHCMD_FAST_READ:
+        case FLASHCMD_QUAD_READ: {
+            if (_flash.cmd == FLASHCMD_FAST_READ || _flash.cmd == FLASHCMD_QUAD_READ) {
+                if (!data_pos) return 0xff; // dummy byte
+                data_pos--;
+            }
+            uint32_t addr = _flash.addr + data_pos;
+            if (_flash.cmd == FLASHCMD_READ_SFDP) {
+                return addr < sizeof(_sfdp) ? _sfdp[addr] : 0xff;
+            }
+            if (!data_pos) sim_flash_counters.reads++;
+            sim_flash_counters.bytes_read++;
+            return _array[addr & (_size - 1)];
+        }
+        case FLASHCMD_PAGE_PROGRAM:
+        case FLASHCMD_QUAD_PAGE_PROGRAM: {
+            uint i = (_flash.addr + data_pos) & 0xffu;
+            _flash.page_buf[i] = tx;
+            _flash.page_buf_used[i] = true;
+            return 0xff;
+        }
+        default:
+            return 0xff;
+    }
+}
+
+// shift one byte each way
+static uint8_t _shift(uint8_t tx) {
+    uint8_t b = _shift_in(tx);
+    // 03h reads, with no dummy byte, are specified to a lower clock than the others (as on many parts)
+    uint32_t min_baud_div = sim_flash_timing.min_baud_div + (_flash.cmd == FLASHCMD_READ_DATA ? 2 : 0);
+    if (_flash.baud_div < min_baud_div) b = (uint8_t) ((b << 1u) | 1u);
+    return b;
+}
+
+uint32_t sim_flash_baud_div() {
+    return _flash.baud_div;
+}
+
+#ifdef SIM_FLASH_SSI
+// ----------------------------------------------------------------------------
+// bus interface for the SSI model
+
+void sim_flash_select() {
+    _select();
+}
+
+void sim_flash_deselect() {
+    _deselect();
+}
+
+uint8_t sim_flash_shift(uint8_t tx) {
+    return _shift(tx);
+}
+
+void sim_flash_set_baud_div(uint32_t div) {
+    if (div < FLASH_BAUD_DIV_MIN || (div & 1u)) sim_panic("invalid SSI clock divider %d", (int) div);
+    _flash.baud_div = div;
+}
+#else
+static void _wait_ready() {
+    uint8_t stat;
+    do {
+        flash_do_cmd(FLASHCMD_READ_STATUS, NULL, &stat, 1);
+    } while (stat & STATUS_WIP && !flash_was_aborted());
+}
+
+static void _put_cmd_addr(uint8_t cmd, uint32_t addr) {
+    _select();
+    _shift(cmd);
+    _shift((uint8_t) (addr >> 16u));
+    _shift((uint8_t) (addr >> 8u));
+    _shift((uint8_t) addr);
+}
+
+// ----------------------------------------------------------------------------
+// program_flash_generic.h API
+
+void connect_internal_flash() {
+}
+
+void flash_init_spi() {
+    _flash.baud_div = FLASH_BAUD_DIV_DEFAULT;
+}
+
+void flash_set_baud_div(uint div) {
+    if (div < FLASH_BAUD_DIV_MIN || (div & 1u)) sim_panic("invalid SSI clock divider %d", (int) div);
+    _flash.baud_div = div;
+}
+
+void flash_put_get(const uint8_t *tx, uint8_t *rx, size_t count, __unused size_t rx_skip) {
+    // the command/address bytes which rx_skip accounts for have already been shifted
+    _select();
+    while (count--) {
+        uint8_t b = _shift(tx ? *tx++ : 0);
+        if (rx) *rx++ = b;
+    }
+    _deselect();
+}
+
+// the model has no DMA; the transfer is the same either way
+void flash_put_get_dma(const uint8_t *tx, uint8_t *rx, size_t count, size_t rx_skip) {
+    flash_put_get(tx, rx, count, rx_skip);
+}
+
+void flash_do_cmd(uint8_t cmd, const uint8_t *tx, uint8_t *rx, size_t count) {
+    _select();
+    _shift(cmd);
+    flash_put_get(tx, rx, count, 1);
+}
+
+void flash_exit_xip() {
+    _deselect();
+    flash_init_spi();
+    sim_advance_ns(sim_flash_timing.xip_mode_change_us * 1000ull);
+}
+
+void flash_page_program(uint32_t addr, const uint8_t *data) {
+    assert(addr < 0x1000000);
+    assert(!(addr & 0xffu));
+    flash_do_cmd(FLASHCMD_WRITE_ENABLE, NULL, NULL, 0);
+    _put_cmd_addr(FLASHCMD_PAGE_PROGRAM, addr);
+    flash_put_get(data, NULL, 256, 4);
+    _wait_ready();
+}
+
+void flash_page_program_dma(uint32_t addr, const uint8_t *data) {
+    flash_page_program(addr, data);
+}
+
+void flash_read_data_dma(uint32_t addr, uint8_t *rx, size_t count) {
+    flash_read_data(addr, rx, count);
+}
+
+void flash_range_program(uint32_t addr, const uint8_t *data, size_t count) {
+    assert(!(addr & 0xffu));
+    uint32_t goal = addr + count;
+    while (addr < goal && !flash_was_aborted()) {
+        flash_page_program(addr, data);
+        addr += 256;
+        data += 256;
+    }
+}
+
+void flash_user_erase(uint32_t addr, uint8_t cmd) {
+    assert(addr < 0x1000000);
+    flash_do_cmd(FLASHCMD_WRITE_ENABLE, NULL, NULL, 0);
+    _put_cmd_addr(cmd, addr);
+    flash_put_get(NULL, NULL, 0, 4);
+    _wait_ready();
+}
+
+void flash_user_erase_start(uint32_t addr, uint8_t cmd) {
+    assert(addr < 0x1000000);
+    flash_do_cmd(FLASHCMD_WRITE_ENABLE, NULL, NULL, 0);
+    _put_cmd_addr(cmd, addr);
+    flash_put_get(NULL, NULL, 0, 4);
+}
+
+bool flash_busy() {
+    uint8_t stat;
+    flash_do_cmd(FLASHCMD_READ_STATUS, NULL, &stat, 1);
+    return stat & STATUS_WIP;
+}
+
+void flash_sector_erase(uint32_t addr) {
+    flash_user_erase(addr, FLASHCMD_SECTOR_ERASE);
+}
+
+void flash_range_erase(uint32_t addr, size_t count, uint32_t block_size, uint8_t block_cmd) {
+    uint32_t goal = addr + count;
+    while (addr < goal && !flash_was_aborted()) {
+        if (!(addr & (block_size - 1)) && goal - addr >= block_size) {
+            flash_user_erase(addr, block_cmd);
+            addr += block_size;
+        } else {
+            flash_sector_erase(addr);
+            addr += 1ul << 12;
+        }
+    }
+}
+
+void flash_read_data(uint32_t addr, uint8_t *rx, size_t count) {
+    assert(addr < 0x1000000);
+    _put_cmd_addr(FLASHCMD_READ_DATA, addr);
+    flash_put_get(NULL, rx, count, 4);
+}
+
+void flash_read_data_fast(uint32_t addr, uint8_t *rx, size_t count) {
+    assert(addr < 0x1000000);
+    _put_cmd_addr(FLASHCMD_FAST_READ, addr);
+    _shift(0); // dummy byte
+    flash_put_get(NULL, rx, count, 5);
+}
+
+int flash_size_log2() {
+    return __builtin_ctz(_size);
+}
+
+void flash_flush_cache() {
+}
+
+void flash_enter_cmd_xip() {
+    sim_advance_ns(sim_flash_timing.xip_mode_change_us * 1000ull);
+}
+
+void flash_enter_cmd_xip_fast() {
+    sim_advance_ns(sim_flash_timing.xip_mode_change_us * 1000ull);
+}
+
+void flash_read_sfdp(uint32_t addr, uint8_t *rx, size_t count) {
+    assert(addr < 0x1000000);
+    _put_cmd_addr(FLASHCMD_READ_SFDP, addr);
+    _shift(0); // dummy byte
+    flash_put_get(NULL, rx, count, 5);
+}
+
+bool flash_enable_quad(uint qer) {
+    // only checking what the model provides
+    if (qer != 4) sim_panic("unexpected QER %d", (int) qer);
+    uint8_t sr[2];
+    flash_do_cmd(FLASHCMD_READ_STATUS, NULL, sr, 1);
+    flash_do_cmd(FLASHCMD_READ_STATUS2, NULL, sr + 1, 1);
+    if (sr[1] & STATUS2_QE) return true;
+    sr[1] |= STATUS2_QE;
+    flash_do_cmd(FLASHCMD_WRITE_ENABLE, NULL, NULL, 0);
+    flash_do_cmd(FLASHCMD_WRITE_STATUS, sr, NULL, 2);
+    _wait_ready();
+    flash_do_cmd(FLASHCMD_READ_STATUS2, NULL, sr, 1);
+    return sr[0] & STATUS2_QE;
+}
+
+void flash_page_program_quad(uint32_t addr, const uint8_t *data) {
+    assert(addr < 0x1000000);
+    assert(!(addr & 0xffu));
+    flash_do_cmd(FLASHCMD_WRITE_ENABLE, NULL, NULL, 0);
+    // the real thing has IRQs disabled for this
+    uint32_t save = save_and_disable_interrupts();
+    _put_cmd_addr(FLASHCMD_QUAD_PAGE_PROGRAM, addr);
+    flash_put_get(data, NULL, 256, 4);
+    restore_interrupts(save);
+    _wait_ready();
+}
+
+void flash_read_data_quad(uint32_t addr, uint8_t *rx, size_t count, uint8_t cmd, uint8_t dummy_clocks) {
+    assert(addr < 0x1000000);
+    assert(!(count & 3u));
+    if (cmd != FLASHCMD_QUAD_READ || dummy_clocks != 8) {
+        sim_panic("unexpected quad read %02x with %d dummy clocks", cmd, dummy_clocks);
+    }
+    // in reads of up to 14 32-bit frames, as the real thing
+    while (count) {
+        uint32_t len = MIN(count, 14 * 4);
+        _put_cmd_addr(FLASHCMD_QUAD_READ, addr);
+        _shift(0); // 8 dummy clocks
+        flash_put_get(NULL, rx, len, 5);
+        addr += len;
+        rx += len;
+        count -= len;
+    }
+}
+
+void flash_abort() {
+    _flash.aborted = true;
+}
+
+int flash_was_aborted() {
+    return _flash.aborted;
+}
+#endif
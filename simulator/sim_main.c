@@ -0,0 +1,542 @@
+/**
+ * Copyright (c) 2020 Raspberry Pi (Trading) Ltd.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <sys/param.h>
+#include <sys/mman.h>
+#include "pico.h"
+#include "async_task.h"
+#include "boot/uf2.h"
+#ifdef USE_FLASH_VERIFY
+#include "bootrom_crc32.h"
+#endif
+#include "sim.h"
+#if defined(SIM_FLASH_SSI) && defined(USE_FLASH_4_BYTE_ADDR)
+#include "program_flash_generic.h"
+#endif
+
+static uint8_t *_uf2;
+static uint32_t _uf2_sectors;
+static uint32_t _image_bytes;
+// flash contents before the download, for checking CURRENT.UF2 and that sectors outside the image are untouched
+static uint8_t *_flash_before;
+// fail if the transfer takes longer than this (in simulated ms), or if fewer erase ahead tasks or 32K/64K block erases
+// than this are run
+static uint32_t _max_time_ms;
+static uint32_t _min_erase_ahead;
+static uint32_t _min_block_erases;
+
+#ifdef USE_UF2_ERASE_AHEAD
+// erase ahead tasks, which the worker only builds (and runs) when it has no queued task; the simulator is linked with
+// --wrap=vd_erase_ahead_task to count them
+static uint32_t _erase_ahead_tasks;
+
+bool __real_vd_erase_ahead_task(struct async_task *task);
+
+bool __wrap_vd_erase_ahead_task(struct async_task *task) {
+    bool erase_ahead = __real_vd_erase_ahead_task(task);
+    if (erase_ahead) _erase_ahead_tasks++;
+    return erase_ahead;
+}
+#endif
+
+static void _usage() {
+    fprintf(stderr,
+            "usage: bootrom_sim [options] [file.uf2]\n"
+            "\n"
+            "Simulates dragging a UF2 onto the RPI-RP2 drive, and reports the transfer rate.\n"
+            "\n"
+            "  --generate <KB>             generate an image of this size to write instead of a file (default 256)\n"
+            "  --base <addr>               address of the generated image (default 0x10000000)\n"
+            "  --payload <bytes>           payload size of the generated UF2 blocks (default 256)\n"
+            "  --gap <bytes>               move the second half of the generated image on by this much\n"
+            "  --shuffle <blocks>          shuffle the UF2 blocks within runs of this many\n"
+            "  --preload <blank|same|changed|random> initial flash contents (default blank); changed is the image\n"
+            "                              with one block in 32 random\n"
+            "  --flash-size <MB>           flash size (default 16)\n"
+            "  --spi-ns-per-byte <ns>      (default %d)\n"
+            "  --page-program-us <us>      (default %d)\n"
+            "  --sector-erase-us <us>      (default %d)\n"
+            "  --block-erase-32k-us <us>   (default %d)\n"
+            "  --block-erase-64k-us <us>   (default %d)\n"
+            "  --flash-min-baud-div <n>    smallest SSI clock divider at which flash reads are reliable (default %d;\n"
+            "                              03h reads need 2 more)\n"
+            "  --flash-bad-page <addr>     address of a flash page which can't be programmed\n"
+            "  --usb-packet-ns <ns>        time per USB bulk transaction (default %d)\n"
+            "  --sectors-per-command <n>   sectors per host WRITE_10 (default %d)\n"
+            "  --read-current-uf2          read CURRENT.UF2 before the download, and check it against the flash\n"
+            "  --read-empty <sectors>      also read this many of the empty sectors after CURRENT.UF2\n"
+            "  --max-time <ms>             fail if the transfer takes longer than this\n"
+            "  --min-erase-ahead <n>       fail if the worker runs fewer than this many erase ahead tasks\n"
+            "  --min-block-erases <n>      fail if the flash sees fewer than this many 32K/64K block erases\n"
+            "  --verbose\n",
+            (int) sim_flash_timing.spi_ns_per_byte, (int) sim_flash_timing.page_program_us,
+            (int) sim_flash_timing.sector_erase_us, (int) sim_flash_timing.block_erase_32k_us,
+            (int) sim_flash_timing.block_erase_64k_us, (int) sim_flash_timing.min_baud_div, (int) sim_usb_config.packet_ns,
+            (int) sim_usb_config.sectors_per_command);
+    exit(1);
+}
+
+static uint32_t _random() {
+    static uint32_t state = 0x12345678;
+    state = state * 1664525u + 1013904223u;
+    // (the low bits of an LCG have short periods, bit n repeating every 2^(n+1) calls, so those of a byte from the
+    // bottom would repeat every 64K)
+    return state >> 16u;
+}
+
+static void _generate_uf2(uint32_t base, uint32_t size, uint32_t payload_size, uint32_t gap) {
+    uint32_t num_blocks = (size + payload_size - 1) / payload_size;
+    _uf2_sectors = num_blocks;
+    _uf2 = calloc(num_blocks, 512);
+    for (uint32_t i = 0; i < num_blocks; i++) {
+        struct uf2_block *b = (struct uf2_block *) (_uf2 + i * 512);
+        b->magic_start0 = UF2_MAGIC_START0;
+        b->magic_start1 = UF2_MAGIC_START1;
+        b->flags = UF2_FLAG_FAMILY_ID_PRESENT;
+        b->target_addr = base + i * payload_size + (i < num_blocks / 2 ? 0 : gap);
+        b->payload_size = i < num_blocks - 1 ? payload_size : size - i * payload_size;
+        b->block_no = i;
+        b->num_blocks = num_blocks;
+        b->file_size = RP2040_FAMILY_ID;
+        for (uint j = 0; j < b->payload_size; j++) {
+            b->data[j] = (uint8_t) _random();
+        }
+        b->magic_end = UF2_MAGIC_END;
+    }
+}
+
+// shuffle the blocks within each run of window blocks, as a host writing the file out of order would
+static void _shuffle_uf2(uint32_t window) {
+    uint8_t tmp[512];
+    for (uint32_t base = 0; base < _uf2_sectors; base += window) {
+        uint32_t n = _uf2_sectors - base < window ? _uf2_sectors - base : window;
+        for (uint32_t i = n - 1; i > 0; i--) {
+            uint32_t j = _random() % (i + 1);
+            memcpy(tmp, _uf2 + (base + i) * 512, 512);
+            memcpy(_uf2 + (base + i) * 512, _uf2 + (base + j) * 512, 512);
+            memcpy(_uf2 + (base + j) * 512, tmp, 512);
+        }
+    }
+}
+
+static void _load_uf2(const char *filename) {
+    FILE *f = fopen(filename, "rb");
+    if (!f) {
+        fprintf(stderr, "can't open %s\n", filename);
+        exit(1);
+    }
+    fseek(f, 0, SEEK_END);
+    long len = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    if (len <= 0 || len % 512) {
+        fprintf(stderr, "%s is not a UF2 file\n", filename);
+        exit(1);
+    }
+    _uf2_sectors = len / 512;
+    _uf2 = malloc(len);
+    if (1 != fread(_uf2, len, 1, f)) {
+        fprintf(stderr, "failed to read %s\n", filename);
+        exit(1);
+    }
+    fclose(f);
+}
+
+// true for a block the bootrom writes to flash
+static bool _is_flash_block(const struct uf2_block *b) {
+#ifdef USE_UF2_PAGE_ASSEMBLY
+    bool payload_ok = b->payload_size && b->payload_size <= sizeof(b->data);
+#else
+    bool payload_ok = b->payload_size == 256 && !(b->target_addr & 0xffu);
+#endif
+    return b->magic_start0 == UF2_MAGIC_START0 && b->magic_start1 == UF2_MAGIC_START1 &&
+           b->magic_end == UF2_MAGIC_END && (b->flags & UF2_FLAG_FAMILY_ID_PRESENT) &&
+           b->file_size == RP2040_FAMILY_ID && !(b->flags & UF2_FLAG_NOT_MAIN_FLASH) && payload_ok &&
+           b->target_addr >= XIP_MAIN_BASE && b->target_addr + b->payload_size <= XIP_MAIN_BASE + sim_flash_size();
+}
+
+static void _preload(const char *how) {
+    if (!strcmp(how, "blank")) return;
+    if (!strcmp(how, "random")) {
+        for (uint32_t i = 0; i < sim_flash_size(); i++) {
+            *sim_flash_contents(i) = (uint8_t) _random();
+        }
+    } else if (!strcmp(how, "same") || !strcmp(how, "changed")) {
+        bool changed = !strcmp(how, "changed");
+        for (uint32_t i = 0; i < _uf2_sectors; i++) {
+            const struct uf2_block *b = (const struct uf2_block *) (_uf2 + i * 512);
+            if (_is_flash_block(b)) {
+                uint8_t *p = sim_flash_contents(b->target_addr - XIP_MAIN_BASE);
+                memcpy(p, b->data, b->payload_size);
+                if (changed && !(b->block_no & 31u)) {
+                    for (uint j = 0; j < b->payload_size; j++) {
+                        p[j] = (uint8_t) _random();
+                    }
+                }
+            }
+        }
+    } else {
+        _usage();
+    }
+}
+
+static void _map(uint32_t base, uint32_t end) {
+    void *p = mmap((void *) (uintptr_t) base, end - base, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+    if (p != (void *) (uintptr_t) base) {
+        fprintf(stderr, "failed to map simulated memory at %08x\n", (uint) base);
+        exit(1);
+    }
+}
+
+#ifdef USE_TASK_STATS
+static void _print_task_stats() {
+    static const char *const names[ASYNC_TASK_STATS_COUNT] = {
+            "exit xip", "flash erase", "read", "write", "exclusive", "enter cmd xip", "exec", "vectorize flash",
+            "queue wait", "irqs disabled", "complete batch",
+    };
+    printf("task timings (us):\n");
+    for (uint i = 0; i < ASYNC_TASK_STATS_COUNT; i++) {
+        const struct async_task_stats *s = &async_task_stats[i];
+        if (s->count) {
+            printf("  %-16s count %7u  avg %7u  min %7u  max %7u\n", names[i], (uint) s->count,
+                   (uint) (s->total_us / s->count), (uint) s->min_us, (uint) s->max_us);
+        }
+    }
+}
+#endif
+
+// CURRENT.UF2 should be the whole of the (original) flash, one page per block
+static bool _check_current_uf2() {
+    uint32_t sector_count;
+    const uint8_t *data = sim_usb_current_uf2(&sector_count);
+    // (which is no more than the 16MB the XIP window reaches)
+    uint32_t expected = MIN(sim_flash_size(), 0x1000000u) / 256;
+    if (sector_count != expected) {
+        printf("FAILED: CURRENT.UF2 has %u blocks rather than %u\n", (uint) sector_count, (uint) expected);
+        return false;
+    }
+    for (uint32_t i = 0; i < sector_count; i++) {
+        const struct uf2_block *b = (const struct uf2_block *) (data + i * 512);
+        if (b->magic_start0 != UF2_MAGIC_START0 || b->magic_start1 != UF2_MAGIC_START1 ||
+            b->magic_end != UF2_MAGIC_END || b->flags != UF2_FLAG_FAMILY_ID_PRESENT ||
+            b->file_size != RP2040_FAMILY_ID || b->target_addr != XIP_MAIN_BASE + i * 256 ||
+            b->payload_size != 256 || b->block_no != i || b->num_blocks != sector_count) {
+            printf("FAILED: CURRENT.UF2 block %u has a bad header\n", (uint) i);
+            return false;
+        }
+        if (memcmp(b->data, _flash_before + i * 256, 256)) {
+            printf("FAILED: CURRENT.UF2 block %u does not match the flash\n", (uint) i);
+            return false;
+        }
+    }
+    for (uint32_t i = 0; i < sim_usb_config.read_empty_sectors * 512; i++) {
+        if (data[sector_count * 512 + i]) {
+            printf("FAILED: empty sector %u after CURRENT.UF2 is not empty\n", (uint) (i / 512));
+            return false;
+        }
+    }
+    double secs = (double) sim_usb_current_uf2_ns() / 1e9;
+    printf("current.uf2: %u blocks read in %.6f s simulated, %.1f KB/s of UF2\n", (uint) sector_count, secs,
+           sector_count * 512 / 1024.0 / secs);
+    return true;
+}
+
+// the bootrom may erase the whole of any sector the image writes, but must leave the others alone
+static bool _check_untouched_sectors() {
+    uint32_t sector_count = sim_flash_size() / 4096;
+    bool *touched = calloc(sector_count, sizeof(bool));
+    for (uint32_t i = 0; i < _uf2_sectors; i++) {
+        const struct uf2_block *b = (const struct uf2_block *) (_uf2 + i * 512);
+        if (_is_flash_block(b)) {
+            // (a payload is smaller than a sector, so can only straddle two)
+            uint32_t offset = b->target_addr - XIP_MAIN_BASE;
+            touched[offset / 4096] = touched[(offset + b->payload_size - 1) / 4096] = true;
+        }
+    }
+    uint32_t changed = 0;
+    for (uint32_t i = 0; i < sector_count; i++) {
+        if (!touched[i] && memcmp(sim_flash_contents(i * 4096), _flash_before + i * 4096, 4096)) {
+            if (!changed) printf("first changed sector outside the image at %08x\n", (uint) (XIP_MAIN_BASE + i * 4096));
+            changed++;
+        }
+    }
+    free(touched);
+    if (changed) {
+        printf("FAILED: %u flash sectors outside the image were changed\n", (uint) changed);
+        return false;
+    }
+    return true;
+}
+
+#if defined(SIM_FLASH_SSI) && defined(USE_FLASH_4_BYTE_ADDR)
+// the bootrom's own downloads don't reach beyond the 16MB XIP window, so on a larger part drive the 4-byte address
+// commands directly once it is done: erase, program and read back 8K either side of the 16MB boundary
+static bool _check_4_byte_addr() {
+    const uint32_t boundary = 0x1000000u, span = 0x2000u;
+    if (sim_flash_size() <= boundary) return true;
+    uint8_t *data = malloc(2 * span);
+    uint8_t *rx = malloc(2 * span);
+    for (uint32_t i = 0; i < 2 * span; i++) data[i] = (uint8_t) _random();
+    // 32K blocks either side (52h then 5Ch)
+    uint32_t erases = sim_flash_counters.block_erases_32k;
+    flash_range_erase(boundary - 0x8000u, 0x10000u, 0x8000u, 0x52);
+    bool ok = sim_flash_counters.block_erases_32k == erases + 2;
+    // a block erase command with no known 4-byte version, which must fall back to (21h) sector erases
+    erases = sim_flash_counters.sector_erases;
+    flash_range_erase(boundary + 0x10000u, 0x8000u, 0x8000u, 0x81);
+    ok &= sim_flash_counters.sector_erases == erases + 8;
+    flash_range_program(boundary - span, data, 2 * span - 256);
+#ifdef USE_FLASH_QUAD
+    flash_page_program_quad(boundary + span - 256, data + 2 * span - 256);
+#else
+    flash_range_program(boundary + span - 256, data + 2 * span - 256, 256);
+#endif
+    ok &= !memcmp(sim_flash_contents(boundary - span), data, 2 * span);
+    // (a 3-byte address read can't be relied on to carry on past 16MB)
+    flash_read_data(boundary - span, rx, span);
+    flash_read_data(boundary, rx + span, span);
+    ok &= !memcmp(rx, data, 2 * span);
+#ifdef USE_FLASH_FAST_READ
+    memset(rx, 0, span);
+    flash_read_data_fast(boundary, rx, span);
+    ok &= !memcmp(rx, data + span, span);
+#endif
+#ifdef USE_FLASH_QUAD
+    memset(rx, 0, span);
+    flash_read_data_quad(boundary, rx, span, async_task_flash_geometry.quad_out_read_cmd,
+                         async_task_flash_geometry.quad_out_read_dummy_clocks);
+    ok &= !memcmp(rx, data + span, span);
+#endif
+    free(data);
+    free(rx);
+    if (!ok) printf("FAILED: 4-byte address erase, program or read beyond 16MB\n");
+    return ok;
+}
+#endif
+
+void sim_finish() {
+    uint32_t mismatches = 0;
+    for (uint32_t i = 0; i < _uf2_sectors; i++) {
+        const struct uf2_block *b = (const struct uf2_block *) (_uf2 + i * 512);
+        if (_is_flash_block(b) && memcmp(sim_flash_contents(b->target_addr - XIP_MAIN_BASE), b->data, b->payload_size)) {
+            if (!mismatches) printf("first flash mismatch at %08x\n", (uint) b->target_addr);
+            mismatches++;
+        }
+    }
+    double secs = (double) sim_usb_done_ns() / 1e9;
+    printf("image: %u bytes in %u UF2 blocks\n", (uint) _image_bytes, (uint) _uf2_sectors);
+    printf("transfer: %.6f s simulated, %.1f KB/s (%.3f MB/s)\n", secs, _image_bytes / 1024.0 / secs,
+           _image_bytes / 1e6 / secs);
+    printf("usb: %u NAKs\n", (uint) sim_usb_naks());
+    printf("flash: %u page programs, %u sector erases, %u 32K block erases, %u 64K block erases, %u reads; "
+           "busy %.3f s; clock divider %u\n", (uint) sim_flash_counters.page_programs,
+           (uint) sim_flash_counters.sector_erases, (uint) sim_flash_counters.block_erases_32k,
+           (uint) sim_flash_counters.block_erases_64k, (uint) sim_flash_counters.reads,
+           (double) sim_flash_counters.busy_ns / 1e9, (uint) sim_flash_baud_div());
+    if (sim_flash_counters.programs_not_erased) {
+        printf("flash: %u page programs were to pages that were not fully erased\n",
+               (uint) sim_flash_counters.programs_not_erased);
+    }
+#ifdef USE_DIFFERENTIAL_FLASH
+    printf("differential: %u sector erases skipped, %u page programs skipped\n",
+           (uint) diff_flash_stats.erases_skipped, (uint) diff_flash_stats.programs_skipped);
+#endif
+#ifdef USE_UF2_ERASE_AHEAD
+    printf("erase ahead: %u tasks run while the worker was idle\n", (uint) _erase_ahead_tasks);
+#else
+    const uint32_t _erase_ahead_tasks = 0;
+#endif
+#ifdef USE_TASK_STATS
+    _print_task_stats();
+#endif
+    bool ok = true;
+#ifdef USE_FLASH_VERIFY
+    uint32_t crc = 0xffffffffu;
+    for (uint32_t i = 0; i < _uf2_sectors; i++) {
+        const struct uf2_block *b = (const struct uf2_block *) (_uf2 + i * 512);
+        if (_is_flash_block(b)) crc = crc32_small(b->data, b->payload_size, crc);
+    }
+    printf("verify: crc %08x over %u bytes (image %08x); %u pages failed verify", (uint) flash_verify_status.crc,
+           (uint) flash_verify_status.length, (uint) crc, (uint) flash_verify_status.mismatches);
+    if (flash_verify_status.mismatches) printf(", first at %08x", (uint) flash_verify_status.first_mismatch_addr);
+    printf("\n");
+    if (!flash_verify_status.mismatches && flash_verify_status.crc != crc) {
+        printf("FAILED: the verify CRC does not match the UF2\n");
+        ok = false;
+    }
+#endif
+    if (sim_usb_failed_commands()) {
+        printf("FAILED: %u WRITE_10 commands failed\n", (uint) sim_usb_failed_commands());
+        ok = false;
+    }
+    if (mismatches) {
+        printf("FAILED: %u flash pages do not match the UF2\n", (uint) mismatches);
+        ok = false;
+    }
+    if (!_check_untouched_sectors()) ok = false;
+    if (_max_time_ms && secs * 1000 > _max_time_ms) {
+        printf("FAILED: the transfer took longer than %u ms\n", (uint) _max_time_ms);
+        ok = false;
+    }
+    if (_erase_ahead_tasks < _min_erase_ahead) {
+        printf("FAILED: fewer than %u erase ahead tasks were run\n", (uint) _min_erase_ahead);
+        ok = false;
+    }
+    if (sim_flash_counters.block_erases_32k + sim_flash_counters.block_erases_64k < _min_block_erases) {
+        printf("FAILED: fewer than %u 32K/64K block erases were run\n", (uint) _min_block_erases);
+        ok = false;
+    }
+    if (sim_usb_config.read_current_uf2 && !_check_current_uf2()) ok = false;
+#if defined(SIM_FLASH_SSI) && defined(USE_FLASH_4_BYTE_ADDR)
+    if (!_check_4_byte_addr()) ok = false;
+#endif
+    if (!sim_reboot_requested()) {
+        printf("FAILED: the bootrom did not reboot after the download\n");
+        ok = false;
+    }
+    if (ok) printf("OK\n");
+    exit(ok ? 0 : 1);
+}
+
+int main(int argc, char **argv) {
+    static const struct option options[] = {
+            {"generate",            required_argument, NULL, 'g'},
+            {"base",                required_argument, NULL, 'b'},
+            {"payload",             required_argument, NULL, 'l'},
+            {"gap",                 required_argument, NULL, 'a'},
+            {"shuffle",             required_argument, NULL, 'x'},
+            {"preload",             required_argument, NULL, 'p'},
+            {"flash-size",          required_argument, NULL, 'f'},
+            {"spi-ns-per-byte",     required_argument, NULL, 's'},
+            {"page-program-us",     required_argument, NULL, 'P'},
+            {"sector-erase-us",     required_argument, NULL, 'S'},
+            {"block-erase-32k-us",  required_argument, NULL, '3'},
+            {"block-erase-64k-us",  required_argument, NULL, '6'},
+            {"flash-min-baud-div",  required_argument, NULL, 'm'},
+            {"flash-bad-page",      required_argument, NULL, 'B'},
+            {"usb-packet-ns",       required_argument, NULL, 'u'},
+            {"sectors-per-command", required_argument, NULL, 'c'},
+            {"read-current-uf2",    no_argument,       NULL, 'r'},
+            {"read-empty",          required_argument, NULL, 'z'},
+            {"max-time",            required_argument, NULL, 't'},
+            {"min-erase-ahead",     required_argument, NULL, 'e'},
+            {"min-block-erases",    required_argument, NULL, 'E'},
+            {"verbose",             no_argument,       NULL, 'v'},
+            {"help",                no_argument,       NULL, 'h'},
+            {NULL, 0,                                  NULL, 0},
+    };
+    uint32_t generate_kb = 256;
+    uint32_t base = XIP_MAIN_BASE;
+    uint32_t payload_size = 256;
+    uint32_t gap = 0;
+    uint32_t shuffle = 0;
+    uint32_t flash_mb = 16;
+    const char *preload = "blank";
+    int c;
+    while (-1 != (c = getopt_long(argc, argv, "", options, NULL))) {
+        uint32_t value = optarg ? (uint32_t) strtoul(optarg, NULL, 0) : 0;
+        switch (c) {
+            case 'g':
+                generate_kb = value;
+                break;
+            case 'b':
+                base = value;
+                break;
+            case 'l':
+                payload_size = value;
+                break;
+            case 'a':
+                gap = value;
+                break;
+            case 'x':
+                shuffle = value;
+                break;
+            case 'p':
+                preload = optarg;
+                break;
+            case 'f':
+                flash_mb = value;
+                break;
+            case 's':
+                sim_flash_timing.spi_ns_per_byte = value;
+                break;
+            case 'P':
+                sim_flash_timing.page_program_us = value;
+                break;
+            case 'S':
+                sim_flash_timing.sector_erase_us = value;
+                break;
+            case '3':
+                sim_flash_timing.block_erase_32k_us = value;
+                break;
+            case '6':
+                sim_flash_timing.block_erase_64k_us = value;
+                break;
+            case 'm':
+                sim_flash_timing.min_baud_div = value;
+                break;
+            case 'B':
+                sim_flash_bad_page = value - XIP_MAIN_BASE;
+                break;
+            case 'u':
+                sim_usb_config.packet_ns = value;
+                break;
+            case 'c':
+                sim_usb_config.sectors_per_command = value;
+                break;
+            case 'r':
+                sim_usb_config.read_current_uf2 = true;
+                break;
+            case 'z':
+                sim_usb_config.read_empty_sectors = value;
+                break;
+            case 't':
+                _max_time_ms = value;
+                break;
+            case 'e':
+                _min_erase_ahead = value;
+                break;
+            case 'E':
+                _min_block_erases = value;
+                break;
+            case 'v':
+                sim_verbose = true;
+                break;
+            default:
+                _usage();
+        }
+    }
+    if (optind < argc - 1 || !sim_usb_config.sectors_per_command || !sim_usb_config.packet_ns) _usage();
+
+    _map(XIP_SRAM_BASE, XIP_SRAM_END);
+    _map(SRAM_BASE, SRAM_END);
+#ifdef SIM_FLASH_SSI
+    sim_ssi_init();
+#endif
+    sim_flash_init(flash_mb * 1024u * 1024u);
+
+    if (optind < argc) {
+        _load_uf2(argv[optind]);
+    } else {
+        if (!generate_kb || !payload_size || payload_size > 476) _usage();
+        _generate_uf2(base, generate_kb * 1024, payload_size, gap);
+    }
+    if (shuffle > 1) _shuffle_uf2(shuffle);
+    for (uint32_t i = 0; i < _uf2_sectors; i++) {
+        const struct uf2_block *b = (const struct uf2_block *) (_uf2 + i * 512);
+        if (b->magic_start0 == UF2_MAGIC_START0) _image_bytes += b->payload_size;
+    }
+    _preload(preload);
+    _flash_before = malloc(sim_flash_size());
+    memcpy(_flash_before, sim_flash_contents(0), sim_flash_size());
+
+    sim_usb_init(_uf2, _uf2_sectors);
+    async_task_worker();
+}
@@ -0,0 +1,181 @@
+/**
+ * Copyright (c) 2020 Raspberry Pi (Trading) Ltd.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+// Virtual time, "interrupts" and the bits of runtime.c / usb_boot_device.c the simulated code depends on
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include "pico.h"
+#include "hardware/sync.h"
+#include "hardware/regs/intctrl.h"
+#include "hardware/structs/timer.h"
+#include "usb_boot_device.h"
+#include "async_task.h"
+#include "bootrom_crc32.h"
+#include "sim.h"
+
+// if the host makes no progress for this long while the worker is idle, we are deadlocked
+#define SIM_DEADLOCK_NS (5ull * 1000 * 1000 * 1000)
+
+timer_hw_t sim_timer_hw;
+bool sim_verbose;
+
+static uint64_t _now_ns;
+static bool _irqs_disabled;
+static bool _irq_pending;
+static bool _event;
+static bool _rebooting;
+
+uint64_t sim_time_ns() {
+    return _now_ns;
+}
+
+static void _set_time(uint64_t ns) {
+    assert(ns >= _now_ns);
+    _now_ns = ns;
+    uint64_t us = ns / 1000;
+    sim_timer_hw.timerawl = (uint32_t) us;
+    sim_timer_hw.timerawh = (uint32_t) (us >> 32u);
+}
+
+// the parts of isr_usbctrl which aren't in sim_usb.c
+static void _usb_isr_preamble() {
+#ifdef USE_BATCHED_TASK_COMPLETION
+    async_task_complete_batch();
+#endif
+}
+
+// deliver a host USB transaction as an IRQ would be
+static void _usb_irq() {
+    _irqs_disabled = true;
+    _irq_pending = false;
+    _usb_isr_preamble();
+    sim_usb_step();
+    _irqs_disabled = false;
+}
+
+// take a pended IRQ with no host transaction behind it, as soon as IRQs are enabled
+static void _check_pending_irq() {
+    if (_irq_pending && !_irqs_disabled) {
+        _irqs_disabled = true;
+        _irq_pending = false;
+        _usb_isr_preamble();
+        _irqs_disabled = false;
+    }
+}
+
+void interrupt_set_pending(uint irq) {
+    assert(irq == USBCTRL_IRQ);
+    _irq_pending = true;
+    _check_pending_irq();
+}
+
+void sim_advance_ns(uint64_t ns) {
+    uint64_t target = _now_ns + ns;
+    while (!_irqs_disabled && sim_usb_next_event_ns() <= target) {
+        uint64_t t = sim_usb_next_event_ns();
+        if (t > _now_ns) _set_time(t);
+        _usb_irq();
+    }
+    _set_time(target);
+}
+
+uint32_t save_and_disable_interrupts() {
+    uint32_t status = _irqs_disabled;
+    _irqs_disabled = true;
+    return status;
+}
+
+void restore_interrupts(uint32_t status) {
+    _irqs_disabled = status;
+    _check_pending_irq();
+}
+
+void __sev() {
+    _event = true;
+}
+
+void __wfe() {
+    assert(!_irqs_disabled);
+    while (!_event) {
+        if (sim_usb_done()) {
+            sim_finish();
+        }
+        uint64_t t = sim_usb_next_event_ns();
+        if (t > _now_ns) _set_time(t);
+        if (_now_ns - sim_usb_last_progress_ns() > SIM_DEADLOCK_NS) {
+            sim_panic("deadlock: host has been NAKed for %ds with the worker idle", (int) (SIM_DEADLOCK_NS / 1000000000ull));
+        }
+        _usb_irq();
+    }
+    _event = false;
+}
+
+void sim_panic(const char *fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    fprintf(stderr, "PANIC at %.6fs: ", (double) _now_ns / 1e9);
+    vfprintf(stderr, fmt, args);
+    fprintf(stderr, "\n");
+    va_end(args);
+    exit(2);
+}
+
+// ----------------------------------------------------------------------------
+// runtime.c
+
+void *__memcpy(void *dest, const void *src, uint n) {
+    return memmove(dest, src, n);
+}
+
+void memset0(void *dest, uint count) {
+    memset(dest, 0, count);
+}
+
+void _noop() {
+}
+
+uint32_t ctz32(uint32_t x) {
+    return __builtin_ctz(x);
+}
+
+bool watchdog_rebooting() {
+    return _rebooting;
+}
+
+// ----------------------------------------------------------------------------
+// bootrom_misc.S
+
+uint32_t crc32_small(const uint8_t *buf, unsigned int len, uint32_t seed) {
+    uint32_t crc = seed;
+    while (len--) {
+        crc ^= (uint32_t) *buf++ << 24u;
+        for (int i = 0; i < 8; i++) {
+            crc = (crc << 1u) ^ ((crc & 0x80000000u) ? 0x04c11db7u : 0);
+        }
+    }
+    return crc;
+}
+
+// ----------------------------------------------------------------------------
+// usb_boot_device.c
+
+char serial_number_string[13] = "E0C9125B0D9B";
+
+uint32_t msc_get_serial_number32() {
+    return 0x0d9b;
+}
+
+void safe_reboot(uint32_t addr, __unused uint32_t sp, __unused uint32_t delay_ms) {
+    if (sim_verbose) printf("%.6fs: reboot requested (addr %08x)\n", (double) _now_ns / 1e9, (uint) addr);
+    _rebooting = true;
+}
+
+bool sim_reboot_requested() {
+    return _rebooting;
+}
@@ -0,0 +1,300 @@
+/**
+ * Copyright (c) 2020 Raspberry Pi (Trading) Ltd.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+// Register model of the SSI (and the QSPI IO/pad and XIP control registers alongside it), so that simulators built
+// with SIM_FLASH_SSI run the real program_flash_generic.c against the NOR model in sim_flash.c.
+//
+// The registers' pages are mapped with no access, so every load or store faults. The fault handler works out the
+// register and (from the page fault error code) whether it is a write. For a read it puts the register's value in the
+// page; either way it opens the page up and single steps the instruction, after which the trap handler closes the
+// page again and, for a write, passes the value stored to the model. This is x86-64 Linux only.
+//
+// The SSI is modelled as clocking each frame out as soon as it is written to DR0 (so the TX FIFO is always empty),
+// in the modes program_flash_generic.c uses:
+//
+// - standard SPI, transmit and receive, with 8 or 32 bit frames (each frame received goes in the RX FIFO)
+// - quad transmit only: the instruction and address frames go out serially, then the data
+// - quad receive only: the instruction and address frames go out serially, and then (after the wait cycles) CTRLR1 + 1
+//   frames are received
+//
+// Chip select follows the GPIO_QSPI_SS output override, and an input override of SD1 low (flash_abort) reads as zeros.
+// Anything else (DMA, an RX FIFO overflow or underflow, a frame written with the SSI disabled) stops the simulation.
+
+#define _GNU_SOURCE
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <ucontext.h>
+#include "pico.h"
+#include "hardware/regs/io_qspi.h"
+#include "hardware/regs/ssi.h"
+#include "hardware/resets.h"
+#include "resets.h"
+#include "sim.h"
+
+#if !defined(__x86_64__) || !defined(__linux__)
+#error SIM_FLASH_SSI needs x86-64 Linux
+#endif
+
+#define PAGE_SIZE 4096u
+#define RX_FIFO_DEPTH 16u
+#define EFLAGS_TF 0x100u
+#define PF_WRITE 0x2u
+
+struct periph {
+    uint32_t base;
+    // value to read from the register at offset (which may have side effects, as reading DR0 does)
+    uint32_t (*read)(struct periph *p, uint32_t offset);
+    // the register at offset was written
+    void (*write)(struct periph *p, uint32_t offset, uint32_t value);
+    uint32_t regs[PAGE_SIZE / 4];
+};
+
+static uint32_t _plain_read(struct periph *p, uint32_t offset);
+static void _plain_write(struct periph *p, uint32_t offset, uint32_t value);
+static uint32_t _ssi_read(struct periph *p, uint32_t offset);
+static void _ssi_write(struct periph *p, uint32_t offset, uint32_t value);
+static void _io_qspi_write(struct periph *p, uint32_t offset, uint32_t value);
+
+static struct periph _ssi = {.base = XIP_SSI_BASE, .read = _ssi_read, .write = _ssi_write};
+static struct periph _io_qspi = {.base = IO_QSPI_BASE, .read = _plain_read, .write = _io_qspi_write};
+static struct periph _pads_qspi = {.base = PADS_QSPI_BASE, .read = _plain_read, .write = _plain_write};
+static struct periph _xip_ctrl = {.base = XIP_CTRL_BASE, .read = _plain_read, .write = _plain_write};
+static struct periph *const _periphs[] = {&_ssi, &_io_qspi, &_pads_qspi, &_xip_ctrl};
+#define PERIPH_COUNT (sizeof(_periphs) / sizeof(_periphs[0]))
+
+// the register whose access is being single stepped (accesses are only ever nested via the model's write handlers,
+// which run once this is clear)
+static struct {
+    struct periph *periph;
+    uint32_t offset;
+    bool write;
+} _stepping;
+
+static uint32_t _plain_read(struct periph *p, uint32_t offset) {
+    return p->regs[offset / 4];
+}
+
+static void _plain_write(struct periph *p, uint32_t offset, uint32_t value) {
+    p->regs[offset / 4] = value;
+}
+
+// ----------------------------------------------------------------------------
+// SSI
+
+#define SSI_REG(offset) _ssi.regs[(offset) / 4]
+
+static struct {
+    uint32_t rx_fifo[RX_FIFO_DEPTH];
+    uint32_t rx_head;
+    uint32_t rx_count;
+    // frames written to DR0 since the SSI was enabled or chip select last went high (quad modes need to know which
+    // is the instruction and which the address)
+    uint32_t frames;
+} _fifo;
+
+static bool _cs_low() {
+    uint32_t ss = _io_qspi.regs[IO_QSPI_GPIO_QSPI_SS_CTRL_OFFSET / 4];
+    return ((ss & IO_QSPI_GPIO_QSPI_SS_CTRL_OUTOVER_BITS) >> IO_QSPI_GPIO_QSPI_SS_CTRL_OUTOVER_LSB) ==
+           IO_QSPI_GPIO_QSPI_SS_CTRL_OUTOVER_VALUE_LOW;
+}
+
+static bool _miso_forced_low() {
+    uint32_t sd1 = _io_qspi.regs[IO_QSPI_GPIO_QSPI_SD1_CTRL_OFFSET / 4];
+    return ((sd1 & IO_QSPI_GPIO_QSPI_SD1_CTRL_INOVER_BITS) >> IO_QSPI_GPIO_QSPI_SD1_CTRL_INOVER_LSB) ==
+           IO_QSPI_GPIO_QSPI_SD1_CTRL_INOVER_VALUE_LOW;
+}
+
+// clock the low bits (a multiple of 8) of frame out, most significant first, returning the bits clocked in
+static uint32_t _clock_frame(uint32_t frame, uint32_t bits) {
+    if (bits & 7u) sim_panic("SSI frame of %d bits", (int) bits);
+    uint32_t in = 0;
+    for (uint32_t shift = bits; shift;) {
+        shift -= 8;
+        uint8_t b = _cs_low() ? sim_flash_shift((uint8_t) (frame >> shift)) : 0xff;
+        in = (in << 8u) | (_miso_forced_low() ? 0 : b);
+    }
+    return in;
+}
+
+static void _rx_push(uint32_t frame) {
+    if (_fifo.rx_count == RX_FIFO_DEPTH) sim_panic("SSI RX FIFO overflow");
+    _fifo.rx_fifo[(_fifo.rx_head + _fifo.rx_count++) % RX_FIFO_DEPTH] = frame;
+}
+
+static uint32_t _field(uint32_t value, uint32_t bits, uint32_t lsb) {
+    return (value & bits) >> lsb;
+}
+
+static void _ssi_dr0_write(uint32_t value) {
+    if (!SSI_REG(SSI_SSIENR_OFFSET)) sim_panic("SSI DR0 written while disabled");
+    uint32_t ctrlr0 = SSI_REG(SSI_CTRLR0_OFFSET);
+    uint32_t spi_ctrlr0 = SSI_REG(SSI_SPI_CTRLR0_OFFSET);
+    uint32_t frf = _field(ctrlr0, SSI_CTRLR0_SPI_FRF_BITS, SSI_CTRLR0_SPI_FRF_LSB);
+    uint32_t tmod = _field(ctrlr0, SSI_CTRLR0_TMOD_BITS, SSI_CTRLR0_TMOD_LSB);
+    uint32_t frame_bits = _field(ctrlr0, SSI_CTRLR0_DFS_32_BITS, SSI_CTRLR0_DFS_32_LSB) + 1;
+    uint32_t frame = _fifo.frames++;
+    if (frf == SSI_CTRLR0_SPI_FRF_VALUE_STD && tmod == SSI_CTRLR0_TMOD_VALUE_TX_AND_RX) {
+        _rx_push(_clock_frame(value, frame_bits));
+        return;
+    }
+    if (frf != SSI_CTRLR0_SPI_FRF_VALUE_QUAD ||
+        (tmod != SSI_CTRLR0_TMOD_VALUE_TX_ONLY && tmod != SSI_CTRLR0_TMOD_VALUE_RX_ONLY) ||
+        _field(spi_ctrlr0, SSI_SPI_CTRLR0_TRANS_TYPE_BITS, SSI_SPI_CTRLR0_TRANS_TYPE_LSB) !=
+        SSI_SPI_CTRLR0_TRANS_TYPE_VALUE_1C1A ||
+        _field(spi_ctrlr0, SSI_SPI_CTRLR0_INST_L_BITS, SSI_SPI_CTRLR0_INST_L_LSB) != 2) {
+        sim_panic("unsupported SSI mode: CTRLR0 %08x SPI_CTRLR0 %08x", (uint) ctrlr0, (uint) spi_ctrlr0);
+    }
+    if (!frame) {
+        // 8-bit instruction
+        _clock_frame(value, 8);
+    } else if (frame == 1) {
+        uint32_t addr_bits = _field(spi_ctrlr0, SSI_SPI_CTRLR0_ADDR_L_BITS, SSI_SPI_CTRLR0_ADDR_L_LSB) * 4;
+        _clock_frame(value, addr_bits);
+        if (tmod == SSI_CTRLR0_TMOD_VALUE_RX_ONLY) {
+            uint32_t wait_cycles = _field(spi_ctrlr0, SSI_SPI_CTRLR0_WAIT_CYCLES_BITS, SSI_SPI_CTRLR0_WAIT_CYCLES_LSB);
+            // (the flash model counts the dummy clocks of its quad read as a byte)
+            if (wait_cycles) _clock_frame(0, wait_cycles);
+            uint32_t ndf = SSI_REG(SSI_CTRLR1_OFFSET) + 1;
+            while (ndf--) _rx_push(_clock_frame(0, frame_bits));
+        }
+    } else if (tmod == SSI_CTRLR0_TMOD_VALUE_TX_ONLY) {
+        _clock_frame(value, frame_bits);
+    } else {
+        sim_panic("SSI DR0 written during a quad receive");
+    }
+}
+
+static uint32_t _ssi_read(__unused struct periph *p, uint32_t offset) {
+    switch (offset) {
+        case SSI_DR0_OFFSET: {
+            if (!_fifo.rx_count) sim_panic("SSI RX FIFO underflow");
+            uint32_t frame = _fifo.rx_fifo[_fifo.rx_head];
+            _fifo.rx_head = (_fifo.rx_head + 1) % RX_FIFO_DEPTH;
+            _fifo.rx_count--;
+            return frame;
+        }
+        case SSI_TXFLR_OFFSET:
+            return 0;
+        case SSI_RXFLR_OFFSET:
+            return _fifo.rx_count;
+        case SSI_SR_OFFSET:
+            return SSI_SR_TFE_BITS | SSI_SR_TFNF_BITS | (_fifo.rx_count ? SSI_SR_RFNE_BITS : 0);
+        default:
+            return SSI_REG(offset);
+    }
+}
+
+static void _ssi_write(__unused struct periph *p, uint32_t offset, uint32_t value) {
+    switch (offset) {
+        case SSI_DR0_OFFSET:
+            _ssi_dr0_write(value);
+            return;
+        case SSI_SSIENR_OFFSET:
+            // disabling the SSI clears its FIFOs
+            if (!(value & 1u)) _fifo.rx_count = 0;
+            _fifo.frames = 0;
+            break;
+        case SSI_BAUDR_OFFSET:
+            sim_flash_set_baud_div(value);
+            break;
+        case SSI_DMACR_OFFSET:
+            if (value) sim_panic("the SSI model has no DMA");
+            break;
+    }
+    SSI_REG(offset) = value;
+}
+
+// ----------------------------------------------------------------------------
+// QSPI IO
+
+static void _io_qspi_write(struct periph *p, uint32_t offset, uint32_t value) {
+    bool was_low = _cs_low();
+    p->regs[offset / 4] = value;
+    if (was_low && !_cs_low()) {
+        _fifo.frames = 0;
+        sim_flash_deselect();
+    } else if (!was_low && _cs_low()) {
+        sim_flash_select();
+    }
+}
+
+void reset_unreset_block_wait_noinline(uint32_t mask) {
+    if (mask & RESETS_RESET_IO_QSPI_BITS) {
+        if (_cs_low()) sim_flash_deselect();
+        memset(_io_qspi.regs, 0, sizeof(_io_qspi.regs));
+    }
+    if (mask & RESETS_RESET_PADS_QSPI_BITS) memset(_pads_qspi.regs, 0, sizeof(_pads_qspi.regs));
+}
+
+// ----------------------------------------------------------------------------
+// Access trapping
+
+static struct periph *_periph_at(uintptr_t addr) {
+    for (uint i = 0; i < PERIPH_COUNT; i++) {
+        if (addr - _periphs[i]->base < PAGE_SIZE) return _periphs[i];
+    }
+    return NULL;
+}
+
+static void _protect(struct periph *p, int prot) {
+    if (mprotect((void *) (uintptr_t) p->base, PAGE_SIZE, prot)) sim_panic("mprotect failed");
+}
+
+static void _segv_handler(int sig, siginfo_t *info, void *context) {
+    ucontext_t *uc = context;
+    struct periph *p = _periph_at((uintptr_t) info->si_addr);
+    if (!p || _stepping.periph) {
+        // a genuine crash; let it happen again with the default action
+        signal(SIGSEGV, SIG_DFL);
+        return;
+    }
+    uint32_t offset = ((uintptr_t) info->si_addr - p->base) & ~3u;
+    bool write = uc->uc_mcontext.gregs[REG_ERR] & PF_WRITE;
+    _protect(p, PROT_READ | PROT_WRITE);
+    // a write may be a read-modify-write, so the page always holds the value to read (without side effects for a write)
+    volatile uint32_t *reg = (volatile uint32_t *) (uintptr_t) (p->base + offset);
+    *reg = write ? p->regs[offset / 4] : p->read(p, offset);
+    _stepping.periph = p;
+    _stepping.offset = offset;
+    _stepping.write = write;
+    uc->uc_mcontext.gregs[REG_EFL] |= EFLAGS_TF;
+}
+
+static void _trap_handler(int sig, siginfo_t *info, void *context) {
+    ucontext_t *uc = context;
+    struct periph *p = _stepping.periph;
+    if (!p) {
+        signal(SIGTRAP, SIG_DFL);
+        return;
+    }
+    uc->uc_mcontext.gregs[REG_EFL] &= ~EFLAGS_TF;
+    uint32_t offset = _stepping.offset;
+    uint32_t value = *(volatile uint32_t *) (uintptr_t) (p->base + offset);
+    bool write = _stepping.write;
+    _stepping.periph = NULL;
+    _protect(p, PROT_NONE);
+    // (the model may advance virtual time, delivering "IRQs" from here, which may access the registers again)
+    if (write) p->write(p, offset, value);
+}
+
+void sim_ssi_init() {
+    for (uint i = 0; i < PERIPH_COUNT; i++) {
+        void *addr = (void *) (uintptr_t) _periphs[i]->base;
+        if (mmap(addr, PAGE_SIZE, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0) != addr) {
+            fprintf(stderr, "failed to map simulated registers at %08x\n", (uint) _periphs[i]->base);
+            exit(1);
+        }
+    }
+    // the handlers must be reentrant, as above
+    struct sigaction sa = {.sa_flags = SA_SIGINFO | SA_NODEFER};
+    sa.sa_sigaction = _segv_handler;
+    sigaction(SIGSEGV, &sa, NULL);
+    sa.sa_sigaction = _trap_handler;
+    sigaction(SIGTRAP, &sa, NULL);
+}
@@ -0,0 +1,643 @@
+/**
+ * Copyright (c) 2020 Raspberry Pi (Trading) Ltd.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+// Stand-in for usb_device.c and the USB controller, plus a USB mass storage (bulk only transport) host.
+//
+// The transfer/packet handling below follows usb_device.c (for bulk endpoints only), but the hardware buffer control
+// registers are replaced by a simple per buffer "available" flag. The host performs one bus transaction per
+// sim_usb_config.packet_ns; a transaction to a buffer the device hasn't made available is NAKed, just like on the
+// real bus, so the host is naturally held off while the device is busy (e.g. waiting on async flash writes)
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/param.h>
+#include "pico.h"
+#include "usb_device.h"
+#include "usb_msc.h"
+#include "scsi.h"
+#include "virtual_disk.h"
+#include "sim.h"
+
+struct sim_usb_config sim_usb_config = {
+        .packet_ns = 53000, // ~19 64 byte bulk packets per 1ms full speed frame
+        .sectors_per_command = 128,
+        .lba = 0x1000,
+};
+
+#define msc_in msc_endpoints[0]
+#define msc_out msc_endpoints[1]
+
+#define HOST_ENUMERATION_NS 100000000u
+
+// the "hardware" side of each endpoint's (double) buffers
+static struct sim_ep_hw {
+    struct {
+        bool available; // owned by the controller
+        uint8_t len;
+        uint8_t data[64];
+    } buf[2];
+    uint8_t next; // next buffer the controller will use
+} _ep_hw[2];
+
+static struct sim_ep_hw *_hw(struct usb_endpoint *ep) {
+    if (ep != &msc_in && ep != &msc_out) {
+        sim_panic("unexpected use of endpoint %d %s", ep->num, ep->in ? "IN" : "OUT");
+    }
+    return &_ep_hw[ep - msc_endpoints];
+}
+
+// ----------------------------------------------------------------------------
+// Device side (follows usb_device.c)
+
+struct usb_endpoint usb_control_in, usb_control_out;
+
+static void _usb_transfer_current_packet_only(struct usb_endpoint *ep) {
+    if (ep->in) {
+        assert(usb_current_in_packet_buffer(ep)->data_len < ep->buffer_size);
+    }
+    usb_packet_done(ep);
+}
+
+const struct usb_transfer_type usb_current_packet_only_transfer_type = {
+        .on_packet = _usb_transfer_current_packet_only,
+        .initial_packet_count = 1,
+};
+
+static uint _ep_buffer_count(const struct usb_endpoint *ep) {
+    return ep->double_buffered ? 2 : 1;
+}
+
+static void _usb_reset_buffers(struct usb_endpoint *ep) {
+    struct sim_ep_hw *hw = _hw(ep);
+    memset(hw, 0, sizeof(*hw));
+    ep->owned_buffer_count = _ep_buffer_count(ep);
+    ep->current_give_buffer = ep->current_take_buffer = 0;
+    ep->first_buffer_after_reset = true;
+}
+
+static void _usb_stall_endpoint(struct usb_endpoint *ep, enum usb_halt_state hs) {
+    if (!ep->halt_state) {
+        ep->halt_state = hs;
+        if (ep->on_stall_change) ep->on_stall_change(ep);
+    } else {
+        if (hs > ep->halt_state) ep->halt_state = hs;
+    }
+}
+
+static void _usb_reset_endpoint(struct usb_endpoint *ep) {
+    ep->current_transfer = NULL;
+    _usb_reset_buffers(ep);
+    ep->current_hw_buffer.valid = false;
+    if (ep->halt_state) {
+        ep->halt_state = HS_NONE;
+        if (ep->on_stall_change) ep->on_stall_change(ep);
+    }
+    // note on_stall_change might have started a transfer; we are always configured
+    if (ep->default_transfer && !ep->current_transfer) {
+        usb_reset_and_start_transfer(ep, ep->default_transfer, ep->default_transfer->type, 0);
+    }
+}
+
+static struct usb_buffer *_usb_current_packet_buffer(struct usb_endpoint *ep) {
+    struct usb_buffer *packet = &ep->current_hw_buffer;
+    if (!packet->valid) {
+        struct sim_ep_hw *hw = _hw(ep);
+        packet->data_max = ep->buffer_size;
+        uint which = ep->in ? ep->current_give_buffer : ep->current_take_buffer;
+        assert(!hw->buf[which].available);
+        packet->data = hw->buf[which].data;
+        packet->data_len = ep->in ? 0 : hw->buf[which].len;
+        packet->valid = true;
+    }
+    return packet;
+}
+
+static void _usb_give_buffer(struct usb_endpoint *ep, uint32_t len) {
+    assert(ep->owned_buffer_count);
+    assert(ep->current_transfer);
+    assert(!ep->halt_state);
+    assert(len <= ep->buffer_size);
+    struct sim_ep_hw *hw = _hw(ep);
+    if (ep->first_buffer_after_reset) {
+        assert(!ep->current_give_buffer);
+        hw->next = 0;
+        ep->first_buffer_after_reset = false;
+    }
+    hw->buf[ep->current_give_buffer].available = true;
+    hw->buf[ep->current_give_buffer].len = (uint8_t) len;
+    if (ep->in) {
+        assert(!len || ep->current_hw_buffer.valid);
+    }
+    ep->current_hw_buffer.valid = false;
+    ep->owned_buffer_count--;
+    ep->current_transfer->remaining_packets_to_submit--;
+    if (ep->double_buffered) {
+        ep->current_give_buffer ^= 1u;
+    }
+}
+
+static void _usb_call_on_packet(struct usb_endpoint *ep) {
+    struct usb_transfer *current_transfer = ep->current_transfer;
+    assert(current_transfer);
+    assert(!current_transfer->outstanding_packet);
+    current_transfer->outstanding_packet = true;
+    current_transfer->type->on_packet(ep);
+}
+
+static void _usb_give_as_many_buffers_as_possible(struct usb_endpoint *ep) {
+    while (ep->current_transfer && ep->current_transfer->remaining_packets_to_submit && ep->owned_buffer_count &&
+           !ep->halt_state) {
+        if (ep->in) {
+            uint old = ep->owned_buffer_count;
+            _usb_call_on_packet(ep);
+            if (old == ep->owned_buffer_count) {
+                break;
+            }
+        } else {
+            _usb_give_buffer(ep, ep->buffer_size);
+        }
+    }
+}
+
+static void _usb_check_for_transfer_completion(struct usb_endpoint *ep) {
+    struct usb_transfer *transfer = ep->current_transfer;
+    assert(transfer);
+    if (ep->halt_state || !(transfer->remaining_packets_to_handle || transfer->outstanding_packet)) {
+        assert(!transfer->completed);
+        transfer->completed = true;
+        ep->current_transfer = NULL;
+        if (ep->halt_state) {
+            transfer->remaining_packets_to_submit = transfer->remaining_packets_to_handle = 0;
+            return;
+        }
+        if (transfer->on_complete) {
+            assert(!ep->chain_transfer);
+            transfer->on_complete(ep, transfer);
+        } else if (ep->chain_transfer) {
+            usb_start_transfer(ep, ep->chain_transfer);
+        }
+    }
+}
+
+static void _usb_handle_transfer(struct usb_endpoint *ep, uint which) {
+    assert(!ep->halt_state);
+    ep->owned_buffer_count++;
+    struct usb_transfer *transfer = ep->current_transfer;
+    if (!transfer) {
+        sim_panic("received unexpected packet on %d %s", ep->num, ep->in ? "IN" : "OUT");
+    }
+    assert(transfer->remaining_packets_to_handle);
+    if (transfer->outstanding_packet) {
+        assert(ep->double_buffered);
+        assert(which != ep->current_take_buffer);
+        transfer->packet_queued = true;
+    } else {
+        ep->current_take_buffer = which;
+        if (!ep->in || transfer->remaining_packets_to_submit) {
+            _usb_call_on_packet(ep);
+        }
+        if (!transfer->completed) {
+            assert(transfer->remaining_packets_to_handle);
+            --transfer->remaining_packets_to_handle;
+            _usb_check_for_transfer_completion(ep);
+        }
+    }
+}
+
+void usb_packet_done(struct usb_endpoint *ep) {
+    struct usb_buffer *buffer = &ep->current_hw_buffer;
+    struct usb_transfer *transfer = ep->current_transfer;
+    assert(transfer);
+    assert(transfer->outstanding_packet);
+    transfer->outstanding_packet = false;
+    _usb_check_for_transfer_completion(ep);
+    if (!transfer->completed) {
+        if (ep->in) {
+            assert(buffer->valid);
+            assert(buffer->data_len <= ep->buffer_size);
+            _usb_give_buffer(ep, buffer->data_len);
+        }
+        ep->current_hw_buffer.valid = false;
+        if (transfer->packet_queued) {
+            transfer->packet_queued = false;
+            ep->owned_buffer_count--;
+            _usb_handle_transfer(ep, ep->current_take_buffer ^ 1u);
+        } else {
+            _usb_give_as_many_buffers_as_possible(ep);
+        }
+    }
+}
+
+void usb_set_default_transfer(struct usb_endpoint *ep, struct usb_transfer *transfer) {
+    assert(!ep->default_transfer);
+    ep->default_transfer = transfer;
+}
+
+void usb_start_transfer(struct usb_endpoint *ep, struct usb_transfer *transfer) {
+    assert(!ep->current_transfer);
+    ep->current_transfer = transfer;
+    ep->chain_transfer = NULL;
+    assert(transfer);
+    assert(!transfer->started);
+    transfer->started = true;
+    assert(transfer->type->on_packet);
+    assert(transfer->remaining_packets_to_submit);
+    assert(transfer->remaining_packets_to_handle);
+    _usb_give_as_many_buffers_as_possible(ep);
+}
+
+void usb_chain_transfer(struct usb_endpoint *ep, struct usb_transfer *transfer) {
+    assert(ep->current_transfer);
+    assert(!ep->current_transfer->completed);
+    assert(!ep->current_transfer->on_complete);
+    ep->chain_transfer = transfer;
+}
+
+void usb_reset_transfer(struct usb_transfer *transfer, const struct usb_transfer_type *type,
+                        usb_transfer_completed_func on_complete) {
+    memset0(transfer, sizeof(struct usb_transfer));
+    transfer->type = type;
+    transfer->on_complete = on_complete;
+    transfer->remaining_packets_to_submit = transfer->remaining_packets_to_handle = type->initial_packet_count;
+}
+
+void usb_reset_and_start_transfer(struct usb_endpoint *ep, struct usb_transfer *transfer,
+                                  const struct usb_transfer_type *type, usb_transfer_completed_func on_complete) {
+    usb_reset_transfer(transfer, type, on_complete);
+    usb_start_transfer(ep, transfer);
+}
+
+void usb_grow_transfer(struct usb_transfer *transfer, uint packet_count) {
+    transfer->remaining_packets_to_submit += packet_count;
+    transfer->remaining_packets_to_handle += packet_count;
+}
+
+void usb_soft_reset_endpoint(struct usb_endpoint *ep) {
+    _usb_reset_endpoint(ep);
+}
+
+void usb_hard_reset_endpoint(struct usb_endpoint *ep) {
+    _usb_reset_endpoint(ep);
+}
+
+void usb_halt_endpoint(struct usb_endpoint *ep) {
+    _usb_stall_endpoint(ep, HS_HALTED);
+}
+
+void usb_halt_endpoint_on_condition(struct usb_endpoint *ep) {
+    _usb_stall_endpoint(ep, HS_HALTED_ON_CONDITION);
+}
+
+void usb_clear_halt_condition(struct usb_endpoint *ep) {
+    if (ep->halt_state == HS_HALTED_ON_CONDITION) {
+        ep->halt_state = HS_HALTED;
+    }
+}
+
+struct usb_buffer *usb_current_in_packet_buffer(struct usb_endpoint *ep) {
+    assert(ep->in);
+    return _usb_current_packet_buffer(ep);
+}
+
+struct usb_buffer *usb_current_out_packet_buffer(struct usb_endpoint *ep) {
+    assert(!ep->in);
+    return _usb_current_packet_buffer(ep);
+}
+
+void usb_start_default_transfer_if_not_already_running_or_halted(struct usb_endpoint *ep) {
+    if (!ep->halt_state && ep->current_transfer != ep->default_transfer) {
+        usb_reset_and_start_transfer(ep, ep->default_transfer, ep->default_transfer->type, 0);
+    }
+}
+
+// from usb_boot_device.c
+uint8_t *usb_get_single_packet_response_buffer(struct usb_endpoint *ep, uint len) {
+    struct usb_buffer *buffer = usb_current_in_packet_buffer(ep);
+    assert(len <= buffer->data_max);
+    memset0(buffer->data, len);
+    buffer->data_len = len;
+    return buffer->data;
+}
+
+// control transfers are only used by MSC class requests, which the host doesn't make
+void usb_start_single_buffer_control_in_transfer() {
+    sim_panic("unexpected control transfer");
+}
+
+void usb_start_empty_control_in_transfer_null_completion() {
+    sim_panic("unexpected control transfer");
+}
+
+// ----------------------------------------------------------------------------
+// Host side
+
+enum host_state {
+    HOST_CBW,
+    HOST_DATA_OUT,
+    HOST_DATA_IN,
+    HOST_CSW,
+    HOST_DONE,
+};
+
+static struct {
+    enum host_state state;
+    const uint8_t *data;
+    uint32_t sector_count;
+    uint32_t sector; // first sector of the current command
+    uint32_t command_sectors;
+    uint32_t offset; // within the current command's data
+    uint32_t tag;
+    uint64_t next_event_ns;
+    uint64_t done_ns;
+    uint64_t last_progress_ns;
+    uint32_t naks;
+    uint32_t failed_commands;
+    // if sim_usb_config.read_current_uf2, the commands are READ_10s of CURRENT.UF2 into read_data until it has all
+    // been read, and then the WRITE_10s of the file
+    bool reading;
+    uint8_t *read_data;
+    uint32_t read_lba;
+    uint32_t read_sector_count;
+    uint32_t write_sector_count;
+    uint64_t read_start_ns;
+    uint64_t read_done_ns;
+} _host;
+
+static void _init_endpoint(struct usb_endpoint *ep, uint num, bool in) {
+    memset(ep, 0, sizeof(*ep));
+    ep->num = num;
+    ep->in = in;
+    ep->buffer_size = 64;
+    ep->double_buffered = true;
+    ep->buffer_bit_index = num * 2u + (in ? 0u : 1u);
+}
+
+static void _host_mount();
+
+void sim_usb_init(const uint8_t *data, uint32_t sector_count) {
+    // the bootrom uses EP1 IN and EP2 OUT for MSC
+    _init_endpoint(&msc_in, 1, true);
+    _init_endpoint(&msc_out, 2, false);
+    msc_on_configure(NULL, true);
+    memset(&_host, 0, sizeof(_host));
+    _host.data = data;
+    _host.sector_count = sector_count;
+    _host.state = sector_count ? HOST_CBW : HOST_DONE;
+    _host.next_event_ns = sim_time_ns();
+    _host_mount();
+    if (sim_usb_config.read_current_uf2) {
+        // CURRENT.UF2 only appears once the bootrom has sized the flash; a real host takes far longer to enumerate
+        _host.write_sector_count = sector_count;
+        _host.reading = true;
+        _host.state = HOST_CBW;
+        _host.next_event_ns += HOST_ENUMERATION_NS;
+    }
+}
+
+// attempt a transaction to the next buffer of the endpoint; returns false if NAKed
+static bool _host_transaction(struct usb_endpoint *ep, uint8_t *data, uint32_t *len) {
+    if (ep->halt_state) {
+        if ((_host.state == HOST_DATA_OUT || _host.state == HOST_DATA_IN) && ep->halt_state < HS_HALTED_ON_CONDITION) {
+            // the device has ended the data phase early (a failed command); clear the halt as the CLEAR_FEATURE handler
+            // in usb_device.c would, and go on to read the CSW
+            usb_hard_reset_endpoint(ep);
+            _host.state = HOST_CSW;
+            return false;
+        }
+        sim_panic("host saw STALL on %s endpoint", ep->in ? "IN" : "OUT");
+    }
+    struct sim_ep_hw *hw = _hw(ep);
+    uint which = hw->next;
+    if (!hw->buf[which].available) {
+        _host.naks++;
+        return false;
+    }
+    if (ep->in) {
+        *len = hw->buf[which].len;
+        memcpy(data, hw->buf[which].data, *len);
+    } else {
+        assert(*len <= 64);
+        memcpy(hw->buf[which].data, data, *len);
+        hw->buf[which].len = (uint8_t) *len;
+    }
+    hw->buf[which].available = false;
+    if (ep->double_buffered) hw->next ^= 1u;
+    _host.last_progress_ns = sim_time_ns();
+    _usb_handle_transfer(ep, which);
+    return true;
+}
+
+static void _host_send_cbw() {
+    struct scsi_cbw cbw;
+    memset(&cbw, 0, sizeof(cbw));
+    uint32_t sectors = MIN(sim_usb_config.sectors_per_command, _host.sector_count - _host.sector);
+    uint32_t lba = (_host.reading ? _host.read_lba : sim_usb_config.lba) + _host.sector;
+    cbw.sig = CBW_SIG;
+    cbw.tag = ++_host.tag;
+    cbw.data_transfer_length = sectors * SECTOR_SIZE;
+    cbw.flags = _host.reading ? 0x80 : 0; // IN or OUT
+    cbw.cb_length = 10;
+    cbw.cb[0] = _host.reading ? READ_10 : WRITE_10;
+    cbw.cb[2] = (uint8_t) (lba >> 24u);
+    cbw.cb[3] = (uint8_t) (lba >> 16u);
+    cbw.cb[4] = (uint8_t) (lba >> 8u);
+    cbw.cb[5] = (uint8_t) lba;
+    cbw.cb[7] = (uint8_t) (sectors >> 8u);
+    cbw.cb[8] = (uint8_t) sectors;
+    uint32_t len = 31;
+    if (_host_transaction(&msc_out, (uint8_t *) &cbw, &len)) {
+        _host.command_sectors = sectors;
+        _host.offset = 0;
+        _host.state = _host.reading ? HOST_DATA_IN : HOST_DATA_OUT;
+    }
+}
+
+// the FAT layout of the disk, as a host finds it from the partition table and boot sector. These sectors are
+// generated synchronously, so we just ask the virtual disk for them rather than reading them over USB
+struct disk_layout {
+    uint32_t sectors_per_cluster;
+    uint32_t root_lba;
+    uint32_t data_lba;
+};
+
+static void _host_read_layout(struct disk_layout *layout) {
+    uint8_t buf[SECTOR_SIZE];
+    vd_read_block(0, 0, buf __comma_removed_for_space(SECTOR_SIZE));
+    uint32_t volume_lba = buf[0x1c6] | (buf[0x1c7] << 8u) | (buf[0x1c8] << 16u) | ((uint32_t) buf[0x1c9] << 24u);
+    vd_read_block(0, volume_lba, buf __comma_removed_for_space(SECTOR_SIZE));
+    layout->sectors_per_cluster = buf[0x0d];
+    layout->root_lba = volume_lba + (buf[0x0e] | (buf[0x0f] << 8u)) + buf[0x10] * (buf[0x16] | (buf[0x17] << 8u));
+    layout->data_lba = layout->root_lba + (buf[0x11] | (buf[0x12] << 8u)) * 32u / SECTOR_SIZE;
+}
+
+// every sector the virtual disk says is empty (so MSC doesn't read it) must be
+static void _host_check_zero_sectors() {
+#ifdef USE_MSC_ZERO_FILL_READS
+    static const uint8_t zeros[SECTOR_SIZE];
+    uint8_t buf[SECTOR_SIZE];
+    for (uint32_t lba = 0; lba < vd_sector_count(); lba++) {
+        uint32_t n = vd_zero_sectors(lba);
+        if (lba + n > vd_sector_count() || (n > 1 && vd_zero_sectors(lba + 1) != n - 1)) {
+            sim_panic("inconsistent run of %u empty sectors at %u", (uint) n, (uint) lba);
+        }
+        if (n) {
+            vd_read_block(0, lba, buf __comma_removed_for_space(SECTOR_SIZE));
+            if (memcmp(buf, zeros, SECTOR_SIZE)) sim_panic("sector %u is not empty", (uint) lba);
+        }
+    }
+#endif
+}
+
+// read everything up to the end of the first two files (INDEX.HTM and INFO_UF2.TXT) twice over, the second time in
+// the opposite order, as a host mounting the disk might; the two must match. The root directory is read last, which
+// (with USE_VD_SECTOR_CACHE) leaves it cached from before the bootrom has sized the flash, so finding CURRENT.UF2
+// later also checks that the cache is flushed when that changes
+static void _host_mount() {
+    struct disk_layout layout;
+    _host_read_layout(&layout);
+    uint32_t count = layout.data_lba + 2 * layout.sectors_per_cluster;
+    uint8_t *first = malloc(count * SECTOR_SIZE);
+    uint8_t buf[SECTOR_SIZE];
+    for (uint32_t lba = 0; lba < count; lba++) {
+        vd_read_block(0, lba, first + lba * SECTOR_SIZE __comma_removed_for_space(SECTOR_SIZE));
+    }
+    for (uint32_t lba = count; lba--;) {
+        vd_read_block(0, lba, buf __comma_removed_for_space(SECTOR_SIZE));
+        if (memcmp(buf, first + lba * SECTOR_SIZE, SECTOR_SIZE)) {
+            sim_panic("sector %u read back differently", (uint) lba);
+        }
+    }
+    vd_read_block(0, layout.root_lba, buf __comma_removed_for_space(SECTOR_SIZE));
+    free(first);
+    _host_check_zero_sectors();
+}
+
+// find CURRENT.UF2 in the root directory
+static void _host_start_reading_current_uf2() {
+    // (now CURRENT.UF2 is there, the empty sectors are different)
+    _host_check_zero_sectors();
+    struct disk_layout layout;
+    _host_read_layout(&layout);
+    uint8_t buf[SECTOR_SIZE];
+    vd_read_block(0, layout.root_lba, buf __comma_removed_for_space(SECTOR_SIZE));
+    for (uint i = 0; i < SECTOR_SIZE; i += 32) {
+        if (!memcmp(buf + i, "CURRENT UF2", 11)) {
+            uint32_t cluster = buf[i + 26] | (buf[i + 27] << 8u);
+            uint32_t size = buf[i + 28] | (buf[i + 29] << 8u) | (buf[i + 30] << 16u) | ((uint32_t) buf[i + 31] << 24u);
+            _host.read_lba = layout.data_lba + (cluster - 2) * layout.sectors_per_cluster;
+            _host.read_sector_count = size / SECTOR_SIZE;
+            _host.sector_count = _host.read_sector_count + sim_usb_config.read_empty_sectors;
+            _host.read_data = malloc(_host.sector_count * SECTOR_SIZE);
+            _host.read_start_ns = sim_time_ns();
+            return;
+        }
+    }
+    sim_panic("there is no CURRENT.UF2");
+}
+
+static void _host_receive_csw() {
+    uint8_t buf[64];
+    uint32_t len;
+    if (_host_transaction(&msc_in, buf, &len)) {
+        struct scsi_csw *csw = (struct scsi_csw *) buf;
+        if (len != sizeof(struct scsi_csw) || csw->sig != CSW_SIG || csw->tag != _host.tag) {
+            sim_panic("host received invalid CSW");
+        }
+        if (csw->status) {
+            printf("%s of %d sectors at sector %d failed (CSW status %d, residue %d)\n",
+                   _host.reading ? "READ_10" : "WRITE_10", (int) _host.command_sectors, (int) _host.sector,
+                   csw->status, (int) csw->residue);
+            _host.failed_commands++;
+        }
+        _host.sector += _host.command_sectors;
+        if (_host.sector == _host.sector_count) {
+            if (_host.reading) {
+                // now write the file
+                _host.reading = false;
+                _host.read_done_ns = sim_time_ns();
+                _host.sector = 0;
+                _host.sector_count = _host.write_sector_count;
+                _host.state = _host.sector_count ? HOST_CBW : HOST_DONE;
+            } else {
+                _host.state = HOST_DONE;
+                _host.done_ns = sim_time_ns();
+            }
+        } else {
+            _host.state = HOST_CBW;
+        }
+    }
+}
+
+void sim_usb_step() {
+    switch (_host.state) {
+        case HOST_CBW:
+            if (_host.reading && !_host.read_data) _host_start_reading_current_uf2();
+            _host_send_cbw();
+            break;
+        case HOST_DATA_OUT: {
+            uint32_t len = 64;
+            if (_host_transaction(&msc_out, (uint8_t *) _host.data + _host.sector * SECTOR_SIZE + _host.offset, &len)) {
+                _host.offset += 64;
+                if (_host.offset == _host.command_sectors * SECTOR_SIZE) {
+                    _host.state = HOST_CSW;
+                }
+            }
+            break;
+        }
+        case HOST_DATA_IN: {
+            uint32_t len;
+            uint8_t *data = _host.read_data + _host.sector * SECTOR_SIZE + _host.offset;
+            if (_host_transaction(&msc_in, data, &len)) {
+                if (len != 64) sim_panic("short packet in READ_10 data");
+                _host.offset += 64;
+                if (_host.offset == _host.command_sectors * SECTOR_SIZE) {
+                    _host.state = HOST_CSW;
+                }
+            }
+            break;
+        }
+        case HOST_CSW:
+            _host_receive_csw();
+            break;
+        default:
+            break;
+    }
+    _host.next_event_ns += sim_usb_config.packet_ns;
+}
+
+uint64_t sim_usb_next_event_ns() {
+    return _host.state == HOST_DONE ? UINT64_MAX : _host.next_event_ns;
+}
+
+bool sim_usb_done() {
+    return _host.state == HOST_DONE;
+}
+
+uint64_t sim_usb_done_ns() {
+    return _host.done_ns - _host.read_done_ns;
+}
+
+uint64_t sim_usb_last_progress_ns() {
+    return _host.last_progress_ns;
+}
+
+uint32_t sim_usb_naks() {
+    return _host.naks;
+}
+
+uint32_t sim_usb_failed_commands() {
+    return _host.failed_commands;
+}
+
+const uint8_t *sim_usb_current_uf2(uint32_t *sector_count) {
+    *sector_count = _host.read_sector_count;
+    return _host.read_data;
+}
+
+uint64_t sim_usb_current_uf2_ns() {
+    return _host.read_done_ns - _host.read_start_ns;
+}
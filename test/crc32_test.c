@@ -0,0 +1,95 @@
+/**
+ * Copyright (c) 2020 Raspberry Pi (Trading) Ltd.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include <stdio.h>
+#include "pico/stdlib.h"
+#include "pico/bootrom.h"
+#include "tictoc.h"
+
+#define ASSERT(x) if (!(x)) { panic("ASSERT: %s l %d: " #x "\n" , __FILE__, __LINE__); }
+
+uint32_t crc32_small(const uint8_t *buf, unsigned int len, uint32_t seed);
+uint32_t crc32_nibble(const uint8_t *buf, unsigned int len, uint32_t seed);
+
+#define TIC t1=cyc();
+#define TOC(x) t1=cyc()-t1; x=t1>>8u; x-=3; // timing overhead
+
+// slow but known to be good
+static uint32_t __noinline crc32_reference(const uint8_t *buf, uint len, uint32_t crc) {
+    for (uint i = 0; i < len; i++) {
+        crc ^= buf[i] << 24u;
+        for (int b = 0; b < 8; b++) {
+            crc = (crc & 0x80000000u) ? (crc << 1u) ^ 0x04c11db7u : crc << 1u;
+        }
+    }
+    return crc;
+}
+
+uint32_t __noinline tictoc_crc32_small(const uint8_t *buf, uint len, uint32_t seed, uint32_t *t) {
+uint t1 = 0;
+TIC;
+uint32_t rc = crc32_small(buf, len, seed);
+TOC(*t);
+return rc;
+}
+
+uint32_t __noinline tictoc_crc32_nibble(const uint8_t *buf, uint len, uint32_t seed, uint32_t *t) {
+uint t1 = 0;
+TIC;
+uint32_t rc = crc32_nibble(buf, len, seed);
+TOC(*t);
+return rc;
+}
+
+static uint32_t xrand_state = 0x12345678;
+
+static uint32_t xrand(void) {
+    xrand_state ^= xrand_state << 13u;
+    xrand_state ^= xrand_state >> 17u;
+    xrand_state ^= xrand_state << 5u;
+    return xrand_state;
+}
+
+static int check_crc32() {
+    printf("------------------- CRC32 ----------------------\n");
+    static uint8_t buf[1024];
+    for (uint i = 0; i < count_of(buf); i++) {
+        buf[i] = xrand();
+    }
+    tictoc_init();
+    for (uint len = 0; len <= count_of(buf); len = len < 16 ? len + 1 : len * 2) {
+        for (uint off = 0; off < 4 && off + len <= count_of(buf); off++) {
+            uint32_t seed = off & 1u ? 0xffffffffu : xrand();
+            uint32_t ta, tb;
+            uint32_t expected = crc32_reference(buf + off, len, seed);
+            uint32_t a = tictoc_crc32_small(buf + off, len, seed, &ta);
+            uint32_t b = tictoc_crc32_nibble(buf + off, len, seed, &tb);
+            if (a != expected || b != expected) {
+                printf("Failed +%d len = %d seed %08x: expected %08x small %08x nibble %08x\n", off, len,
+                       (uint) seed, (uint) expected, (uint) a, (uint) b);
+                return 1;
+            }
+            if (!off) {
+                printf("len = %d\t%d\t%d\n", len, (int)ta, (int)tb);
+            }
+        }
+    }
+    // the bootrom function table entry
+    uint32_t (*rom_crc32)(const uint8_t *, uint, uint32_t) = rom_func_lookup(rom_table_code('C', '3'));
+    if (rom_crc32) {
+        ASSERT(rom_crc32(buf, count_of(buf), 0xffffffffu) == crc32_reference(buf, count_of(buf), 0xffffffffu));
+    } else {
+        printf("(no CRC32 in this bootrom)\n");
+    }
+    return 0;
+}
+
+int main() {
+    setup_default_uart();
+    ASSERT(!check_crc32());
+    printf("OK\n");
+    return 0;
+}
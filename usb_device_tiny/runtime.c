@@ -67,6 +67,11 @@ void interrupt_enable(uint irq, bool enable) {
     }
 }
 
+void interrupt_set_pending(uint irq) {
+    assert(irq < N_IRQS);
+    *(volatile uint32_t *) (PPB_BASE + M0PLUS_NVIC_ISPR_OFFSET) = 1u << irq;
+}
+
 void watchdog_reboot(uint32_t pc, uint32_t sp, uint32_t delay_ms) {
     check_hw_layout(watchdog_hw_t, scratch[7], WATCHDOG_SCRATCH7_OFFSET);
     // Set power regs such that everything is reset by the watchdog
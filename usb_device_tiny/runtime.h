@@ -61,6 +61,7 @@ extern void *__memcpy(void *dest, const void *src, uint n);
 #define memcpy __memcpy
 extern void memset0(void *dest, uint count);
 void interrupt_enable(uint int_num, bool enable);
+void interrupt_set_pending(uint int_num);
 void watchdog_reboot(uint32_t pc, uint32_t sp, uint32_t delay_ms);
 extern bool watchdog_rebooting();
 
@@ -16,6 +16,10 @@
 #include "usb_stream_helper.h"
 #endif
 
+#ifdef USE_BATCHED_TASK_COMPLETION
+#include "async_task.h"
+#endif
+
 // -------------------------------------------------------------------------------------------------------------
 // Note this is a small code size focused USB device abstraction, which also avoids using any mutable static
 // data so it is easy to include in bootrom.
@@ -1069,6 +1073,11 @@ void __isr __used isr_usbctrl(void) {
     uint32_t status = usb_hw->ints;
     DEBUG_PINS_SET(usb_irq, 1);
 
+#ifdef USE_BATCHED_TASK_COMPLETION
+    // the async task worker pends this IRQ when it has completed tasks
+    async_task_complete_batch();
+#endif
+
     uint32_t handled = 0;
     if (status & USB_INTS_SETUP_REQ_BITS) {
         handled |= USB_INTS_SETUP_REQ_BITS;
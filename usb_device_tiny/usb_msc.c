@@ -15,7 +15,7 @@
 #include "scsi_ir.h"
 #include "generated.h"
 
-static __attribute__((aligned(4))) uint8_t _sector_buf[SECTOR_SIZE];
+static __attribute__((aligned(4))) uint8_t _sector_buf[MSC_SECTOR_BUFFER_COUNT][SECTOR_SIZE];
 
 struct __packed scsi_request_sense_response {
     uint8_t code;
@@ -205,6 +205,23 @@ static void _scsi_handle_inquiry_response(struct scsi_cbw *cbw) {
 static struct msc_sector_transfer {
     struct usb_stream_transfer stream;
     uint32_t lba;
+#ifdef USE_MSC_ZERO_FILL_READS
+    // (for a READ_10) the end of the run of empty sectors lba is in, if it is in one
+    uint32_t zero_end_lba;
+#endif
+#if MSC_SECTOR_BUFFER_COUNT > 1
+    // async token for each sector buffer currently being written; the in_flight buffers are those immediately
+    // preceding buffer_index (the buffer the stream is filling), so the oldest is buffer_index - in_flight
+    uint32_t tokens[MSC_SECTOR_BUFFER_COUNT];
+    uint8_t buffer_index;
+    uint8_t in_flight;
+    // when on_chunk returned async, the in_flight count at or below which we call usb_stream_chunk_done;
+    // -1 if we are not waiting
+    int8_t wait_in_flight;
+    // a write for this command has failed (and the CSW been sent), so the completions of the writes still in flight
+    // are just counted off
+    bool failed;
+#endif
 } _msc_sector_transfer;
 
 static void _msc_on_sector_stream_packet_complete(__removed_for_space(struct usb_stream_transfer *transfer)) {
@@ -212,14 +229,52 @@ static void _msc_on_sector_stream_packet_complete(__removed_for_space(struct usb
     _msc_state.csw.residue -= 64;
 }
 
-__rom_function_static_impl(bool, _msc_on_sector_stream_chunk)(__unused uint32_t chunk_len__comma_removed_for_space(
+__rom_function_static_impl(bool, _msc_on_sector_stream_chunk)(__unused uint32_t chunk_len __comma_removed_for_space(
         struct usb_stream_transfer *transfer)) {
     assert(transfer == &_msc_sector_transfer.stream);
     assert(chunk_len == SECTOR_SIZE);
+#ifdef USE_MSC_ZERO_FILL_READS
+    if (_msc_sector_transfer.stream.ep->in) {
+        uint32_t lba = _msc_sector_transfer.lba;
+        if (lba >= _msc_sector_transfer.zero_end_lba) {
+            _msc_sector_transfer.zero_end_lba = lba + vd_zero_sectors(lba);
+        }
+        _msc_sector_transfer.stream.zero_chunk = lba < _msc_sector_transfer.zero_end_lba;
+        if (_msc_sector_transfer.stream.zero_chunk) {
+            _msc_sector_transfer.lba++;
+            return false;
+        }
+    }
+#endif
     bool (*vd_read_or_write)(uint32_t token, uint32_t lba, uint8_t *buf __comma_removed_for_space(uint32_t buf_size));
     vd_read_or_write = _msc_sector_transfer.stream.ep->in ? vd_read_block : vd_write_block;
-    return vd_read_or_write(++_msc_async_token, _msc_sector_transfer.lba++, _sector_buf
+#if MSC_SECTOR_BUFFER_COUNT > 1
+    bool async = vd_read_or_write(++_msc_async_token, _msc_sector_transfer.lba++, _msc_sector_transfer.stream.chunk_buffer
+                                  __comma_removed_for_space(SECTOR_SIZE));
+    if (_msc_sector_transfer.stream.ep->in) {
+        return async;
+    }
+    uint in_flight = _msc_sector_transfer.in_flight;
+    if (async) {
+        // the buffer now belongs to the write; move the stream on to the next one, which if still in flight
+        // itself will not be touched until we call usb_stream_chunk_done below
+        _msc_sector_transfer.tokens[_msc_sector_transfer.buffer_index++ & (MSC_SECTOR_BUFFER_COUNT - 1u)] = _msc_async_token;
+        _msc_sector_transfer.stream.chunk_buffer = _sector_buf[_msc_sector_transfer.buffer_index & (MSC_SECTOR_BUFFER_COUNT - 1u)];
+        _msc_sector_transfer.in_flight = ++in_flight;
+    }
+    if (in_flight) {
+        // we must not complete the data phase (and send the CSW) until all writes are done
+        bool last = usb_stream_out_chunk_is_last(&_msc_sector_transfer.stream);
+        if (last || in_flight == MSC_SECTOR_BUFFER_COUNT) {
+            _msc_sector_transfer.wait_in_flight = last ? 0 : MSC_SECTOR_BUFFER_COUNT - 1;
+            return true;
+        }
+    }
+    return false;
+#else
+    return vd_read_or_write(++_msc_async_token, _msc_sector_transfer.lba++, _sector_buf[0]
                             __comma_removed_for_space(SECTOR_SIZE));
+#endif
 }
 
 static const struct usb_stream_transfer_funcs _msc_sector_funcs = {
@@ -233,6 +288,31 @@ void vd_async_complete(uint32_t token, uint32_t result) {
     // note that this USB library is not thread safe, however this is the only function called
     // from non IRQ handler code after usb_device_start; therefore we just disable IRQs for this call
     uint32_t save = save_and_disable_interrupts();
+#if MSC_SECTOR_BUFFER_COUNT > 1
+    // writes complete in the order they were queued, so we only ever expect the oldest outstanding token
+    uint in_flight = _msc_sector_transfer.in_flight;
+    if (in_flight &&
+        token == _msc_sector_transfer.tokens[(_msc_sector_transfer.buffer_index - in_flight) & (MSC_SECTOR_BUFFER_COUNT - 1u)]) {
+        _msc_sector_transfer.in_flight = --in_flight;
+        if (!_msc_sector_transfer.failed) {
+            if (result) {
+#ifndef USB_SILENT_FAIL_ON_EXCLUSIVE
+                _msc_set_csw_failed(SK_DATA_PROTECT, ASC_ACCESS_DENIED, 2); // no access rights
+#endif
+                _msc_state.stall_direction_before_csw = SCSI_DIR_OUT;
+                _msc_data_phase_complete();
+                // ignore the completion of any later writes for this command (they stay in tokens, so never
+                // match _msc_async_token below)
+                _msc_sector_transfer.failed = true;
+                in_flight = 0;
+            }
+            if (_msc_sector_transfer.wait_in_flight >= 0 && in_flight <= (uint) _msc_sector_transfer.wait_in_flight) {
+                _msc_sector_transfer.wait_in_flight = -1;
+                usb_stream_chunk_done(&_msc_sector_transfer.stream);
+            }
+        }
+    } else
+#endif
     if (token == _msc_async_token) {
         if (result) {
             // if we error, we'll just abort and send csw
@@ -240,7 +320,12 @@ void vd_async_complete(uint32_t token, uint32_t result) {
 #ifndef USB_SILENT_FAIL_ON_EXCLUSIVE
             _msc_set_csw_failed(SK_DATA_PROTECT, ASC_ACCESS_DENIED, 2); // no access rights
 #endif
+#ifdef USE_CURRENT_UF2
+            // (CURRENT.UF2 reads are async too)
+            _msc_state.stall_direction_before_csw = _msc_sector_transfer.stream.ep->in ? SCSI_DIR_IN : SCSI_DIR_OUT;
+#else
             _msc_state.stall_direction_before_csw = SCSI_DIR_OUT;
+#endif
             _msc_data_phase_complete();
         }
         usb_stream_chunk_done(&_msc_sector_transfer.stream);
@@ -255,6 +340,9 @@ static void _scsi_read_or_write_blocks(const struct scsi_cbw *cbw, uint32_t lba,
     assert(dir);
     _msc_sector_transfer.stream.ep = (dir == SCSI_DIR_IN) ? &msc_in : &msc_out;
     _msc_sector_transfer.lba = lba;
+#ifdef USE_MSC_ZERO_FILL_READS
+    _msc_sector_transfer.zero_end_lba = 0;
+#endif
     uint32_t expected_length = blocks * SECTOR_SIZE;
     if (_msc_init_for_di_or_do(cbw, expected_length, dir)) {
         assert(_msc_state.data_phase_length <= expected_length);
@@ -264,9 +352,15 @@ static void _scsi_read_or_write_blocks(const struct scsi_cbw *cbw, uint32_t lba,
         if (expected_length) {
 #ifdef USB_NO_TRANSFER_ON_INIT
             _msc_async_token++;
+#endif
+#if MSC_SECTOR_BUFFER_COUNT > 1
+            _msc_sector_transfer.buffer_index = 0;
+            _msc_sector_transfer.in_flight = 0;
+            _msc_sector_transfer.wait_in_flight = -1;
+            _msc_sector_transfer.failed = false;
 #endif
             // transfer length is exact multiple of 64 as per above rounding comment
-            usb_stream_setup_transfer(&_msc_sector_transfer.stream, &_msc_sector_funcs, _sector_buf, SECTOR_SIZE,
+            usb_stream_setup_transfer(&_msc_sector_transfer.stream, &_msc_sector_funcs, _sector_buf[0], SECTOR_SIZE,
                                       expected_length * 64,
                                       _tf_data_phase_complete);
             if (dir == SCSI_DIR_IN) {
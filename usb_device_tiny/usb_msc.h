@@ -11,6 +11,16 @@
 
 #define SECTOR_SIZE 512u
 
+// number of sector buffers used for WRITE_10; must be a power of 2. With more than one, the host may send the
+// following sectors while the virtual disk is still writing earlier ones asynchronously
+#ifndef MSC_SECTOR_BUFFER_COUNT
+#define MSC_SECTOR_BUFFER_COUNT 1
+#endif
+static_assert(MSC_SECTOR_BUFFER_COUNT && !(MSC_SECTOR_BUFFER_COUNT & (MSC_SECTOR_BUFFER_COUNT - 1)), "");
+
+// USE_MSC_ZERO_FILL_READS: READ_10 sectors the virtual disk says are empty (which is most of the disk) are sent by
+// zeroing each packet in the endpoint buffer, rather than having vd_read_block clear a sector buffer to copy from
+
 bool msc_setup_request_handler(struct usb_interface *interface, struct usb_setup_packet *setup);
 void msc_on_configure(__unused struct usb_device *device, bool configured);
 //struct usb_endpoint msc_in, msc_out;
@@ -29,6 +29,11 @@ void usb_stream_packet_handler_complete(struct usb_stream_transfer *transfer) {
             data_len = transfer->transfer_length - transfer->offset;
         }
         buffer->data_len = data_len;
+#ifdef USE_MSC_ZERO_FILL_READS
+        if (transfer->zero_chunk) {
+            memset0(buffer->data, data_len);
+        } else
+#endif
         memcpy(buffer->data, transfer->chunk_buffer + chunk_offset, data_len);
     } else {
         buffer = usb_current_out_packet_buffer(ep);
@@ -121,6 +126,9 @@ void usb_stream_setup_transfer(struct usb_stream_transfer *transfer, const struc
     assert(!(chunk_size & 63u)); // buffer should be a multiple of USB packet buffer size
     transfer->chunk_size = chunk_size;
     transfer->offset = 0;
+#ifdef USE_MSC_ZERO_FILL_READS
+    transfer->zero_chunk = false;
+#endif
     // todo combine with residue?
     transfer->transfer_length = transfer_length;
     usb_reset_transfer(&transfer->core, &_usb_stream_transfer_type, on_complete);
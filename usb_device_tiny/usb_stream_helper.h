@@ -19,6 +19,11 @@ struct usb_stream_transfer {
     uint8_t *chunk_buffer;
     struct usb_endpoint *ep;
     const struct usb_stream_transfer_funcs *funcs;
+#ifdef USE_MSC_ZERO_FILL_READS
+    // for IN, set by on_chunk if the chunk is all zeros, in which case the packets are zeroed in the endpoint buffer
+    // rather than copied from chunk_buffer (which on_chunk then needn't fill)
+    bool zero_chunk;
+#endif
 #ifndef NDEBUG
     bool packet_handler_complete_expected;
 #endif
@@ -40,6 +45,11 @@ void usb_stream_setup_transfer(struct usb_stream_transfer *transfer, const struc
 
 void usb_stream_chunk_done(struct usb_stream_transfer *transfer);
 
+// for use from on_chunk of an OUT transfer; true if this chunk is the last one of the transfer
+static inline bool usb_stream_out_chunk_is_last(struct usb_stream_transfer *transfer) {
+    return transfer->offset + 64 >= transfer->transfer_length;
+}
+
 #ifndef USB_BOOT_EXPANDED_RUNTIME
 extern void _noop();
 #define usb_stream_noop_on_packet_complete ((stream_on_packet_complete_function)_noop)
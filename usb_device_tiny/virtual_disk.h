@@ -11,6 +11,24 @@
 
 #define USE_INFO_UF2
 
+// USE_CURRENT_UF2: the disk also has a CURRENT.UF2, generated on the fly with one UF2 block per flash page, so the
+// flash can be backed up (or copied to another device) by just copying a file. Each sector read of its data is an
+// async flash read; the FAT chain and directory entry are derived from the flash size, which the async task worker
+// probes when it starts
+
+// USE_UF2_PAGE_ASSEMBLY: accept UF2 blocks with any payload size (up to the 476 bytes a block has room for) at any
+// address, rather than just 256 byte flash pages. Images with full size payloads take little more than half the
+// sectors to send; the async task worker assembles their payloads into flash pages (see async_task.c)
+
+// USE_UF2_BLOCK_INTERVALS: track the UF2 blocks received (and flash sectors erased) as a few intervals, falling back
+// to the bitmaps in XIP SRAM only for an image written well out of order. This makes starting a new download constant
+// time, and lifts the limit on the number of blocks in an image (which otherwise comes from the bitmap size)
+
+// USE_VD_SECTOR_CACHE: keep the last VD_SECTOR_CACHE_SECTORS (default 4) metadata sectors read (partition table,
+// boot sector, FAT, root directory and INDEX.HTM) ready built, so the reads a host repeats while mounting (and after
+// each write) are just a copy. The sectors' data takes VD_SECTOR_CACHE_BUFFER_SIZE of XIP SRAM from the flash bitmaps
+// (see async_task.h), so the cache is given up for good once a RAM download (or PICOBOOT write) lands there
+
 void vd_init();
 void vd_reset();
 
@@ -36,4 +54,21 @@ static inline uint32_t vd_sector_count() {
 #endif
 
 void vd_async_complete(uint32_t token, uint32_t result);
+
+#ifdef USE_MSC_ZERO_FILL_READS
+// the number of sectors from lba on which vd_read_block would just return zeros (so 0 if lba itself has data)
+uint32_t vd_zero_sectors(uint32_t lba);
+#endif
+
+#ifdef USE_VD_SECTOR_CACHE
+// called by the async task worker before a RAM write overlapping the sector cache's data
+void vd_sector_cache_disable();
+#endif
+
+#ifdef USE_UF2_ERASE_AHEAD
+struct async_task;
+// called by the async task worker with IRQs disabled when it would otherwise sleep; returns true (having filled in
+// task) if there is a flash sector we expect the current UF2 download to write soon, that may be erased ahead of time
+bool vd_erase_ahead_task(struct async_task *task);
+#endif
 #endif